@@ -0,0 +1,254 @@
+#include "harness.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace bench
+{
+
+double elapsedUs(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count() / 1000.0;
+}
+
+double Samples::quantile(double quantile) const
+{
+    if (values_.empty())
+        return 0;
+    if (!sorted_) {
+        std::sort(values_.begin(), values_.end());
+        sorted_ = true;
+    }
+    const size_t rank = std::max<size_t>(1, std::ceil(quantile * values_.size()));
+    return values_[std::min(rank, values_.size()) - 1];
+}
+
+std::string Samples::toJson() const
+{
+    double sum = 0;
+    for (const double value : values_)
+        sum += value;
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "{\"count\":%zu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+             values_.size(), values_.empty() ? 0.0 : sum / values_.size(),
+             quantile(0.5), quantile(0.9), quantile(0.99), quantile(1.0));
+    return buffer;
+}
+
+bool Process::start(const std::vector<std::string> &argv,
+                    const std::vector<std::string> &env, int keep_fd)
+{
+    stop();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid > 0) {
+        pid_ = pid;
+        return true;
+    }
+    // Child: the results go to stdout, keep it free of the child's output.
+    const int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+    for (const std::string &entry : env)
+        putenv(strdup(entry.c_str()));
+    if (keep_fd >= 0)
+        fcntl(keep_fd, F_SETFD, 0);
+    std::vector<char *> args;
+    for (const std::string &arg : argv)
+        args.push_back(const_cast<char *>(arg.c_str()));
+    args.push_back(nullptr);
+    execvp(args[0], args.data());
+    perror(args[0]);
+    _exit(127);
+}
+
+void Process::stop()
+{
+    if (pid_ <= 0)
+        return;
+    kill(pid_, SIGTERM);
+    waitpid(pid_, nullptr, 0);
+    pid_ = -1;
+}
+
+Session::Session(const Options &options)
+    : options_(options)
+{
+}
+
+Session::~Session()
+{
+    // The WM goes first, it is a client of the display.
+    wm_.stop();
+    xvfb_.stop();
+}
+
+bool Session::startDisplay()
+{
+    // Xvfb picks a free display and writes its number to -displayfd when it
+    // is ready for connections.
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return false;
+    }
+    const bool started = xvfb_.start({"Xvfb", "-displayfd", std::to_string(fds[1]),
+                                      "-screen", "0", "1280x1024x24", "-nolisten", "tcp"},
+                                     {}, fds[1]);
+    close(fds[1]);
+    char number[16] = {};
+    size_t length = 0;
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    while (started && length < sizeof(number) - 1 && poll(&pfd, 1, 5000) > 0) {
+        const ssize_t n = read(fds[0], number + length, sizeof(number) - 1 - length);
+        if (n <= 0)
+            break;
+        length += n;
+        if (number[length - 1] == '\n')
+            break;
+    }
+    close(fds[0]);
+    if (length == 0 || number[length - 1] != '\n') {
+        fprintf(stderr, "Xvfb did not start\n");
+        return false;
+    }
+    number[length - 1] = '\0';
+    display_ = std::string(":") + number;
+    return true;
+}
+
+bool Session::startWm()
+{
+    std::vector<std::string> env = {"DISPLAY=" + display_, "GLOG_minloglevel=2"};
+    env.insert(env.end(), options_.wm_env.begin(), options_.wm_env.end());
+    if (!wm_.start({options_.wm}, env))
+        return false;
+    // The WM is up once someone selected SubstructureRedirect on the root.
+    // Selecting it ourselves to find out would race with the WM.
+    xcb_connection_t *c = connect();
+    if (c == nullptr)
+        return false;
+    const xcb_window_t root = xcb_setup_roots_iterator(xcb_get_setup(c)).data->root;
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    bool ready = false;
+    while (!ready && Clock::now() < deadline) {
+        xcb_get_window_attributes_reply_t *attributes = xcb_get_window_attributes_reply(
+            c, xcb_get_window_attributes(c, root), nullptr);
+        ready = attributes
+                && (attributes->all_event_masks & XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT);
+        free(attributes);
+        if (!ready)
+            usleep(1000);
+    }
+    xcb_disconnect(c);
+    if (!ready)
+        fprintf(stderr, "%s did not take over %s\n", options_.wm.c_str(), display_.c_str());
+    return ready;
+}
+
+xcb_connection_t *Session::connect() const
+{
+    xcb_connection_t *c = xcb_connect(display_.c_str(), nullptr);
+    if (xcb_connection_has_error(c)) {
+        xcb_disconnect(c);
+        fprintf(stderr, "can't connect to %s\n", display_.c_str());
+        return nullptr;
+    }
+    return c;
+}
+
+xcb_generic_event_t *waitFor(xcb_connection_t *c,
+                             const std::function<bool(const xcb_generic_event_t *)> &match,
+                             int timeout_ms)
+{
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    xcb_flush(c);
+    for (;;) {
+        xcb_generic_event_t *event;
+        while ((event = xcb_poll_for_event(c))) {
+            if (match(event))
+                return event;
+            free(event);
+        }
+        if (xcb_connection_has_error(c))
+            return nullptr;
+        const int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             deadline - Clock::now())
+                             .count();
+        if (left <= 0)
+            return nullptr;
+        struct pollfd pfd = {xcb_get_file_descriptor(c), POLLIN, 0};
+        poll(&pfd, 1, left);
+    }
+}
+
+xcb_window_t createWindow(xcb_connection_t *c, bool delete_window)
+{
+    xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(c)).data;
+    const xcb_window_t w = xcb_generate_id(c);
+    const uint32_t values[] = {screen->white_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY};
+    xcb_create_window(c, XCB_COPY_FROM_PARENT, w, screen->root, 100, 100, 200, 150, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    if (delete_window) {
+        const xcb_atom_t protocol = internAtom(c, "WM_DELETE_WINDOW");
+        xcb_change_property(c, XCB_PROP_MODE_REPLACE, w, internAtom(c, "WM_PROTOCOLS"),
+                            XCB_ATOM_ATOM, 32, 1, &protocol);
+    }
+    return w;
+}
+
+xcb_window_t parentOf(xcb_connection_t *c, xcb_window_t w)
+{
+    xcb_query_tree_reply_t *tree = xcb_query_tree_reply(c, xcb_query_tree(c, w), nullptr);
+    if (tree == nullptr)
+        return XCB_NONE;
+    const xcb_window_t parent = tree->parent;
+    free(tree);
+    return parent;
+}
+
+xcb_atom_t internAtom(xcb_connection_t *c, const char *name)
+{
+    xcb_intern_atom_reply_t *reply =
+        xcb_intern_atom_reply(c, xcb_intern_atom(c, 0, strlen(name), name), nullptr);
+    if (reply == nullptr)
+        return XCB_NONE;
+    const xcb_atom_t atom = reply->atom;
+    free(reply);
+    return atom;
+}
+
+xcb_keycode_t keycodeOf(xcb_connection_t *c, xcb_keysym_t keysym)
+{
+    const xcb_setup_t *setup = xcb_get_setup(c);
+    const uint8_t count = setup->max_keycode - setup->min_keycode + 1;
+    xcb_get_keyboard_mapping_reply_t *mapping = xcb_get_keyboard_mapping_reply(
+        c, xcb_get_keyboard_mapping(c, setup->min_keycode, count), nullptr);
+    if (mapping == nullptr)
+        return 0;
+    const xcb_keysym_t *keysyms = xcb_get_keyboard_mapping_keysyms(mapping);
+    const int length = xcb_get_keyboard_mapping_keysyms_length(mapping);
+    xcb_keycode_t keycode = 0;
+    for (int i = 0; i < length && keycode == 0; ++i) {
+        if (keysyms[i] == keysym)
+            keycode = setup->min_keycode + i / mapping->keysyms_per_keycode;
+    }
+    free(mapping);
+    return keycode;
+}
+
+} // namespace bench
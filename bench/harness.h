@@ -0,0 +1,146 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+extern "C" {
+#include <xcb/xcb.h>
+}
+#include <sys/types.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Microseconds between two points in time.
+double elapsedUs(Clock::time_point from, Clock::time_point to);
+
+/***
+ * @description: Measurements of one kind, reported as percentiles
+ */
+class Samples
+{
+public:
+    void add(double value) { values_.push_back(value); }
+    size_t size() const { return values_.size(); }
+    /***
+     * @description: Nearest-rank percentile
+     * @param {double} quantile between 0 and 1
+     * @return {double} 0 if there are no samples
+     */
+    double quantile(double quantile) const;
+    // {"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"max":..}
+    std::string toJson() const;
+
+private:
+    mutable std::vector<double> values_;
+    mutable bool sorted_ = false;
+};
+
+/***
+ * @description: Child process, killed when the object goes away
+ */
+class Process
+{
+public:
+    Process() = default;
+    ~Process() { stop(); }
+
+    Process(const Process &) = delete;
+    Process &operator=(const Process &) = delete;
+
+    /***
+     * @description: Start a program
+     * @param {vector<string>} &argv program and its arguments
+     * @param {vector<string>} &env extra NAME=value environment entries
+     * @param {int} keep_fd descriptor inherited by the child, -1 for none
+     * @return {bool} false if fork failed
+     */
+    bool start(const std::vector<std::string> &argv,
+               const std::vector<std::string> &env = {}, int keep_fd = -1);
+    // SIGTERM, then wait for the child.
+    void stop();
+    bool running() const { return pid_ > 0; }
+
+private:
+    pid_t pid_ = -1;
+};
+
+struct Options
+{
+    std::string wm = TINYWM_PATH; // window manager under test
+    std::vector<std::string> wm_env; // e.g. TINYWM_MOTION_RATE=0
+    unsigned windows = 200; // windows mapped by the map/close scenarios
+    unsigned adopt_windows = 50; // pre-existing windows of the adoption scenario
+    unsigned adopt_runs = 5;
+    unsigned drag_steps = 500;
+    unsigned layout_windows = 500; // windows of the layout computation
+    unsigned layout_runs = 1000;
+    unsigned desktop_windows = 100; // windows per desktop of the switch scenario
+    unsigned desktop_switches = 50;
+    int timeout_ms = 2000; // giving up on an event
+};
+
+/***
+ * @description: A private Xvfb display with the WM under test
+ */
+class Session
+{
+public:
+    explicit Session(const Options &options);
+    ~Session();
+
+    // False if the display or the WM could not be started.
+    bool startDisplay();
+    bool startWm();
+    void stopWm() { wm_.stop(); }
+
+    /***
+     * @description: Open a client connection to the display
+     * @return {xcb_connection_t *} nullptr on failure, the caller disconnects it
+     */
+    xcb_connection_t *connect() const;
+    const std::string &display() const { return display_; }
+    const Options &options() const { return options_; }
+
+private:
+    const Options &options_;
+    Process xvfb_;
+    Process wm_;
+    std::string display_;
+};
+
+/***
+ * @description: Wait for an event matching a predicate, dropping the others
+ * @param {xcb_connection_t} *c connection to read from
+ * @param {function} match returns true for the awaited event
+ * @param {int} timeout_ms giving up after this long
+ * @return {xcb_generic_event_t *} the event to be freed, nullptr on timeout
+ */
+xcb_generic_event_t *waitFor(xcb_connection_t *c,
+                             const std::function<bool(const xcb_generic_event_t *)> &match,
+                             int timeout_ms);
+
+/***
+ * @description: Create a 200x150 top-level window selecting StructureNotify
+ * @param {xcb_connection_t} *c client connection
+ * @param {bool} delete_window whether to take part in WM_DELETE_WINDOW
+ * @return {xcb_window_t} the window, not mapped yet
+ */
+xcb_window_t createWindow(xcb_connection_t *c, bool delete_window = false);
+
+// Parent of a window, XCB_NONE on error. One round trip.
+xcb_window_t parentOf(xcb_connection_t *c, xcb_window_t w);
+
+xcb_atom_t internAtom(xcb_connection_t *c, const char *name);
+
+// Keycode producing a keysym, 0 if no key does. One round trip.
+xcb_keycode_t keycodeOf(xcb_connection_t *c, xcb_keysym_t keysym);
+
+} // namespace bench
+
+#endif // BENCH_HARNESS_H
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "harness.h"
+#include "scenarios.h"
+
+namespace
+{
+
+void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Runs tinywm on a private Xvfb display and prints latencies as JSON.\n"
+            "  --layout-only        only time the layout computation, without X\n"
+            "  --wm PATH            window manager under test (default %s)\n"
+            "  --windows N          windows of the map and close scenarios (200)\n"
+            "  --adopt-windows N    pre-existing windows at startup (50)\n"
+            "  --adopt-runs N       WM restarts of the adoption scenario (5)\n"
+            "  --drag-steps N       pointer motions per drag (500)\n"
+            "  --motion-rate N      TINYWM_MOTION_RATE of the WM\n"
+            "  --desktop-windows N  windows per desktop of the switch scenario (100)\n"
+            "  --desktop-switches N desktop switches timed (50)\n"
+            "  --layout-windows N   windows of the layout computation (500)\n"
+            "  --layout-runs N      layout computations per layout (1000)\n"
+            "  --output FILE        write the JSON to FILE instead of stdout\n",
+            program, TINYWM_PATH);
+}
+
+bool readUnsigned(const char *text, unsigned &value)
+{
+    char *end = nullptr;
+    const unsigned long parsed = strtoul(text, &end, 10);
+    if (*text == '\0' || *end != '\0')
+        return false;
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bench::Options options;
+    std::string output;
+    bool layout_only = false;
+    for (int i = 1; i < argc; ++i) {
+        const char *option = argv[i];
+        if (strcmp(option, "--layout-only") == 0) {
+            layout_only = true;
+            continue;
+        }
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = value != nullptr;
+        if (ok && strcmp(option, "--wm") == 0)
+            options.wm = value;
+        else if (ok && strcmp(option, "--windows") == 0)
+            ok = readUnsigned(value, options.windows);
+        else if (ok && strcmp(option, "--adopt-windows") == 0)
+            ok = readUnsigned(value, options.adopt_windows);
+        else if (ok && strcmp(option, "--adopt-runs") == 0)
+            ok = readUnsigned(value, options.adopt_runs);
+        else if (ok && strcmp(option, "--drag-steps") == 0)
+            ok = readUnsigned(value, options.drag_steps);
+        else if (ok && strcmp(option, "--motion-rate") == 0)
+            options.wm_env.push_back(std::string("TINYWM_MOTION_RATE=") + value);
+        else if (ok && strcmp(option, "--desktop-windows") == 0)
+            ok = readUnsigned(value, options.desktop_windows);
+        else if (ok && strcmp(option, "--desktop-switches") == 0)
+            ok = readUnsigned(value, options.desktop_switches);
+        else if (ok && strcmp(option, "--layout-windows") == 0)
+            ok = readUnsigned(value, options.layout_windows) && options.layout_windows > 0;
+        else if (ok && strcmp(option, "--layout-runs") == 0)
+            ok = readUnsigned(value, options.layout_runs);
+        else if (ok && strcmp(option, "--output") == 0)
+            output = value;
+        else
+            ok = false;
+        if (!ok) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        ++i;
+    }
+
+    std::string results = bench::layoutScenario(options);
+    if (!layout_only) {
+        bench::Session session(options);
+        if (!session.startDisplay())
+            return EXIT_FAILURE;
+        // Adoption starts and stops the WM itself, the others share one instance.
+        results += "," + bench::adoptionScenario(session);
+        if (!session.startWm())
+            return EXIT_FAILURE;
+        results += "," + bench::mapScenario(session);
+        results += "," + bench::dragScenario(session);
+        results += "," + bench::closeScenario(session);
+        results += "," + bench::desktopScenario(session);
+    }
+
+    char parameters[256];
+    snprintf(parameters, sizeof(parameters),
+             "{\"windows\":%u,\"adopt_windows\":%u,\"adopt_runs\":%u,\"drag_steps\":%u,"
+             "\"desktop_windows\":%u,\"desktop_switches\":%u,"
+             "\"layout_windows\":%u,\"layout_runs\":%u}",
+             options.windows, options.adopt_windows, options.adopt_runs,
+             options.drag_steps, options.desktop_windows, options.desktop_switches,
+             options.layout_windows, options.layout_runs);
+    const std::string json = std::string("{\"wm\":\"") + options.wm
+                             + "\",\"parameters\":" + parameters
+                             + ",\"results\":{" + results + "}}\n";
+    FILE *out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (out == nullptr) {
+        perror(output.c_str());
+        return EXIT_FAILURE;
+    }
+    fputs(json.c_str(), out);
+    if (out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
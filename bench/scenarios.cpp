@@ -0,0 +1,430 @@
+#include "scenarios.h"
+
+extern "C" {
+#include <xcb/xtest.h>
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include "layout.h"
+
+namespace bench
+{
+
+namespace
+{
+
+// Keysyms of the keys pressed through XTEST.
+constexpr xcb_keysym_t KEYSYM_ESCAPE = 0xff1b;
+constexpr xcb_keysym_t KEYSYM_CONTROL_L = 0xffe3;
+constexpr xcb_keysym_t KEYSYM_ALT_L = 0xffe9;
+
+uint8_t eventType(const xcb_generic_event_t *event)
+{
+    return event->response_type & ~0x80;
+}
+
+xcb_window_t rootOf(xcb_connection_t *c)
+{
+    return xcb_setup_roots_iterator(xcb_get_setup(c)).data->root;
+}
+
+// Wait for the server to process everything sent so far.
+void sync(xcb_connection_t *c)
+{
+    free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), nullptr));
+}
+
+void fakeInput(xcb_connection_t *c, uint8_t type, uint8_t detail,
+               int16_t x = 0, int16_t y = 0)
+{
+    xcb_test_fake_input(c, type, detail, XCB_CURRENT_TIME, rootOf(c), x, y, 0);
+}
+
+// Map a window and wait until the WM framed it, returning the frame.
+xcb_window_t mapFramed(xcb_connection_t *c, xcb_window_t w, int timeout_ms)
+{
+    xcb_map_window(c, w);
+    xcb_generic_event_t *event = waitFor(
+        c, [w](const xcb_generic_event_t *e) {
+            return eventType(e) == XCB_MAP_NOTIFY
+                   && reinterpret_cast<const xcb_map_notify_event_t *>(e)->window == w;
+        },
+        timeout_ms);
+    if (event == nullptr)
+        return XCB_NONE;
+    free(event);
+    const xcb_window_t frame = parentOf(c, w);
+    if (frame == rootOf(c))
+        return XCB_NONE;
+    const uint32_t mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+    xcb_change_window_attributes(c, frame, XCB_CW_EVENT_MASK, &mask);
+    return frame;
+}
+
+std::string member(const char *name, const std::string &value)
+{
+    return std::string("\"") + name + "\":" + value;
+}
+
+std::string number(double value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+} // namespace
+
+std::string adoptionScenario(Session &session)
+{
+    const Options &options = session.options();
+    Samples adoption;
+    unsigned failures = 0;
+    for (unsigned run = 0; run < options.adopt_runs; ++run) {
+        xcb_connection_t *c = session.connect();
+        if (c == nullptr)
+            break;
+        std::vector<xcb_window_t> windows;
+        for (unsigned i = 0; i < options.adopt_windows; ++i) {
+            windows.push_back(createWindow(c));
+            xcb_map_window(c, windows.back());
+        }
+        sync(c);
+
+        const Clock::time_point start = Clock::now();
+        if (!session.startWm()) {
+            xcb_disconnect(c);
+            break;
+        }
+        std::set<xcb_window_t> waiting(windows.begin(), windows.end());
+        while (!waiting.empty()) {
+            xcb_generic_event_t *event = waitFor(
+                c, [](const xcb_generic_event_t *e) {
+                    return eventType(e) == XCB_REPARENT_NOTIFY;
+                },
+                options.timeout_ms);
+            if (event == nullptr)
+                break;
+            waiting.erase(reinterpret_cast<xcb_reparent_notify_event_t *>(event)->window);
+            free(event);
+        }
+        if (waiting.empty())
+            adoption.add(elapsedUs(start, Clock::now()) / 1000.0);
+        else
+            ++failures;
+
+        // The save set puts the windows back on the root.
+        session.stopWm();
+        for (const xcb_window_t w : windows)
+            xcb_destroy_window(c, w);
+        xcb_disconnect(c);
+    }
+    return member("adoption_ms", adoption.toJson()) + ","
+           + member("adoption_failures", std::to_string(failures));
+}
+
+std::string mapScenario(Session &session)
+{
+    const Options &options = session.options();
+    xcb_connection_t *c = session.connect();
+    if (c == nullptr)
+        return member("map_to_visible_us", Samples().toJson());
+    Samples latency;
+    unsigned failures = 0;
+    std::vector<xcb_window_t> windows;
+    for (unsigned i = 0; i < options.windows; ++i) {
+        const xcb_window_t w = createWindow(c);
+        windows.push_back(w);
+        sync(c);
+
+        // Visible means reparented into a frame and then mapped.
+        bool reparented = false;
+        const Clock::time_point start = Clock::now();
+        xcb_map_window(c, w);
+        xcb_generic_event_t *event = waitFor(
+            c, [w, &reparented](const xcb_generic_event_t *e) -> bool {
+                if (eventType(e) == XCB_REPARENT_NOTIFY
+                    && reinterpret_cast<const xcb_reparent_notify_event_t *>(e)->window == w)
+                    reparented = true;
+                return eventType(e) == XCB_MAP_NOTIFY
+                       && reinterpret_cast<const xcb_map_notify_event_t *>(e)->window == w;
+            },
+            options.timeout_ms);
+        const Clock::time_point end = Clock::now();
+        if (event && reparented)
+            latency.add(elapsedUs(start, end));
+        else
+            ++failures;
+        free(event);
+    }
+    // The windows stay until the end, so the WM manages more and more of them.
+    for (const xcb_window_t w : windows)
+        xcb_destroy_window(c, w);
+    sync(c);
+    xcb_disconnect(c);
+    return member("map_to_visible_us", latency.toJson()) + ","
+           + member("map_failures", std::to_string(failures));
+}
+
+std::string dragScenario(Session &session)
+{
+    const Options &options = session.options();
+    const std::string empty = member("motion_to_move_us", Samples().toJson());
+    xcb_connection_t *c = session.connect();
+    if (c == nullptr)
+        return empty;
+    const xcb_window_t w = createWindow(c);
+    const xcb_window_t frame = mapFramed(c, w, options.timeout_ms);
+    const xcb_keycode_t alt = keycodeOf(c, KEYSYM_ALT_L);
+    xcb_get_geometry_reply_t *geometry =
+        frame ? xcb_get_geometry_reply(c, xcb_get_geometry(c, frame), nullptr) : nullptr;
+    if (geometry == nullptr || alt == 0) {
+        fprintf(stderr, "drag: no frame or no Alt key\n");
+        free(geometry);
+        xcb_disconnect(c);
+        return empty;
+    }
+    const int16_t frame_x = geometry->x;
+    const int16_t start_x = geometry->x + 50;
+    const int16_t start_y = geometry->y + 50;
+    free(geometry);
+
+    // Grab the window with Alt+Button1 inside the client.
+    fakeInput(c, XCB_MOTION_NOTIFY, 0, start_x, start_y);
+    fakeInput(c, XCB_KEY_PRESS, alt);
+    fakeInput(c, XCB_BUTTON_PRESS, 1);
+    sync(c);
+
+    auto movedTo = [frame](int16_t x) {
+        return [frame, x](const xcb_generic_event_t *e) -> bool {
+            if (eventType(e) != XCB_CONFIGURE_NOTIFY)
+                return false;
+            const xcb_configure_notify_event_t *configure =
+                reinterpret_cast<const xcb_configure_notify_event_t *>(e);
+            return configure->window == frame && configure->x == x;
+        };
+    };
+
+    // 1. Latency: one pixel to the right, wait for the frame to follow.
+    Samples latency;
+    int16_t x = start_x;
+    for (unsigned step = 0; step < options.drag_steps; ++step) {
+        ++x;
+        const Clock::time_point start = Clock::now();
+        fakeInput(c, XCB_MOTION_NOTIFY, 0, x, start_y);
+        xcb_generic_event_t *event =
+            waitFor(c, movedTo(frame_x + x - start_x), options.timeout_ms);
+        if (event == nullptr)
+            break;
+        latency.add(elapsedUs(start, Clock::now()));
+        free(event);
+    }
+
+    // 2. Throughput: all the way back at once, count the frame configures.
+    unsigned configures = 0;
+    const Clock::time_point start = Clock::now();
+    for (unsigned step = 0; step < options.drag_steps; ++step)
+        fakeInput(c, XCB_MOTION_NOTIFY, 0, --x, start_y);
+    const auto isFinal = movedTo(frame_x + x - start_x);
+    xcb_generic_event_t *event = waitFor(
+        c, [frame, &configures, &isFinal](const xcb_generic_event_t *e) -> bool {
+            if (eventType(e) == XCB_CONFIGURE_NOTIFY
+                && reinterpret_cast<const xcb_configure_notify_event_t *>(e)->window == frame)
+                ++configures;
+            return isFinal(e);
+        },
+        options.timeout_ms * 5);
+    const double seconds = elapsedUs(start, Clock::now()) / 1e6;
+    const bool finished = event != nullptr;
+    free(event);
+
+    fakeInput(c, XCB_BUTTON_RELEASE, 1);
+    fakeInput(c, XCB_KEY_RELEASE, alt);
+    xcb_destroy_window(c, w);
+    sync(c);
+    xcb_disconnect(c);
+    return member("motion_to_move_us", latency.toJson()) + ","
+           + member("drag_configures_per_second", number(finished ? configures / seconds : 0)) + ","
+           + member("drag_motions_per_second", number(finished ? options.drag_steps / seconds : 0));
+}
+
+std::string closeScenario(Session &session)
+{
+    const Options &options = session.options();
+    xcb_connection_t *c = session.connect();
+    if (c == nullptr)
+        return member("close_message_us", Samples().toJson());
+    const xcb_atom_t protocols = internAtom(c, "WM_PROTOCOLS");
+    const xcb_atom_t delete_window = internAtom(c, "WM_DELETE_WINDOW");
+    const xcb_keycode_t control = keycodeOf(c, KEYSYM_CONTROL_L);
+    const xcb_keycode_t escape = keycodeOf(c, KEYSYM_ESCAPE);
+    Samples message_latency;
+    Samples unframe_latency;
+    unsigned failures = 0;
+    for (unsigned i = 0; i < options.windows; ++i) {
+        const xcb_window_t w = createWindow(c, true);
+        const xcb_window_t frame = mapFramed(c, w, options.timeout_ms);
+        if (frame == XCB_NONE) {
+            ++failures;
+            xcb_destroy_window(c, w);
+            continue;
+        }
+        xcb_set_input_focus(c, XCB_INPUT_FOCUS_POINTER_ROOT, w, XCB_CURRENT_TIME);
+        sync(c);
+
+        // The legacy close binding, Ctrl+Escape.
+        const Clock::time_point start = Clock::now();
+        fakeInput(c, XCB_KEY_PRESS, control);
+        fakeInput(c, XCB_KEY_PRESS, escape);
+        fakeInput(c, XCB_KEY_RELEASE, escape);
+        fakeInput(c, XCB_KEY_RELEASE, control);
+        xcb_generic_event_t *event = waitFor(
+            c, [w, protocols, delete_window](const xcb_generic_event_t *e) {
+                const xcb_client_message_event_t *message =
+                    reinterpret_cast<const xcb_client_message_event_t *>(e);
+                return eventType(e) == XCB_CLIENT_MESSAGE && message->window == w
+                       && message->type == protocols
+                       && message->data.data32[0] == delete_window;
+            },
+            options.timeout_ms);
+        if (event == nullptr) {
+            ++failures;
+            xcb_destroy_window(c, w);
+            continue;
+        }
+        message_latency.add(elapsedUs(start, Clock::now()));
+        free(event);
+
+        // A well-behaved client goes away at once.
+        xcb_destroy_window(c, w);
+        event = waitFor(
+            c, [frame](const xcb_generic_event_t *e) {
+                return eventType(e) == XCB_DESTROY_NOTIFY
+                       && reinterpret_cast<const xcb_destroy_notify_event_t *>(e)->window == frame;
+            },
+            options.timeout_ms);
+        if (event)
+            unframe_latency.add(elapsedUs(start, Clock::now()));
+        else
+            ++failures;
+        free(event);
+    }
+    xcb_disconnect(c);
+    return member("close_message_us", message_latency.toJson()) + ","
+           + member("close_to_unframed_us", unframe_latency.toJson()) + ","
+           + member("close_failures", std::to_string(failures));
+}
+
+namespace
+{
+
+// Ask the WM for another desktop and wait until it is shown.
+bool switchDesktop(xcb_connection_t *c, xcb_atom_t current_desktop, uint32_t desktop,
+                   int timeout_ms)
+{
+    xcb_client_message_event_t message;
+    memset(&message, 0, sizeof(message));
+    message.response_type = XCB_CLIENT_MESSAGE;
+    message.window = rootOf(c);
+    message.type = current_desktop;
+    message.format = 32;
+    message.data.data32[0] = desktop;
+    message.data.data32[1] = XCB_CURRENT_TIME;
+    xcb_send_event(c, 0, rootOf(c),
+                   XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT,
+                   reinterpret_cast<const char *>(&message));
+    xcb_flush(c);
+    xcb_generic_event_t *event = waitFor(
+        c, [current_desktop](const xcb_generic_event_t *e) {
+            return eventType(e) == XCB_PROPERTY_NOTIFY
+                   && reinterpret_cast<const xcb_property_notify_event_t *>(e)->atom
+                          == current_desktop;
+        },
+        timeout_ms);
+    free(event);
+    return event != nullptr;
+}
+
+} // namespace
+
+std::string desktopScenario(Session &session)
+{
+    const Options &options = session.options();
+    xcb_connection_t *c = session.connect();
+    if (c == nullptr)
+        return member("desktop_switch_us", Samples().toJson());
+    const xcb_atom_t current_desktop = internAtom(c, "_NET_CURRENT_DESKTOP");
+    const uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_change_window_attributes(c, rootOf(c), XCB_CW_EVENT_MASK, &mask);
+
+    // The WM starts on desktop 0, so switching to 1 publishes a change.
+    std::vector<xcb_window_t> windows;
+    unsigned failures = 0;
+    for (uint32_t desktop : {1u, 0u}) {
+        if (!switchDesktop(c, current_desktop, desktop, options.timeout_ms))
+            ++failures;
+        for (unsigned i = 0; i < options.desktop_windows; ++i) {
+            windows.push_back(createWindow(c));
+            if (mapFramed(c, windows.back(), options.timeout_ms) == XCB_NONE)
+                ++failures;
+        }
+    }
+    Samples latency;
+    for (unsigned i = 0; i < options.desktop_switches; ++i) {
+        const Clock::time_point start = Clock::now();
+        if (switchDesktop(c, current_desktop, (i + 1) % 2, options.timeout_ms))
+            latency.add(elapsedUs(start, Clock::now()));
+        else
+            ++failures;
+    }
+    for (const xcb_window_t w : windows)
+        xcb_destroy_window(c, w);
+    switchDesktop(c, current_desktop, 0, options.timeout_ms);
+    xcb_disconnect(c);
+    return member("desktop_switch_us", latency.toJson()) + ","
+           + member("desktop_failures", std::to_string(failures));
+}
+
+std::string layoutScenario(const Options &options)
+{
+    using x11::Layout;
+    x11::LayoutParams params;
+    params.area = x11::Rect(0, 0, 1920, 1080);
+    params.border = 5;
+    params.title = 18;
+    std::string results;
+    for (Layout layout = x11::next_layout(Layout::FLOATING); layout != Layout::FLOATING;
+         layout = x11::next_layout(layout)) {
+        std::vector<x11::Placement> placements, previous;
+        x11::arrange(layout, params, options.layout_windows, previous);
+        Samples relayout;
+        size_t changed = 0;
+        for (unsigned run = 0; run < options.layout_runs; ++run) {
+            // A window mapped or unmapped, as the WM relayouts after either.
+            const size_t count = options.layout_windows - run % 2;
+            const Clock::time_point start = Clock::now();
+            x11::arrange(layout, params, count, placements);
+            for (size_t i = 0; i < count; ++i) {
+                if (i >= previous.size() || placements[i].frame != previous[i].frame
+                    || placements[i].client != previous[i].client)
+                    ++changed;
+            }
+            relayout.add(elapsedUs(start, Clock::now()));
+            placements.swap(previous);
+        }
+        if (!results.empty())
+            results += ",";
+        results += member(x11::layout_name(layout), relayout.toJson());
+        // Keeps the diff from being optimized away.
+        results += "," + member((std::string(x11::layout_name(layout)) + "_changed").c_str(),
+                                std::to_string(changed / std::max(options.layout_runs, 1u)));
+    }
+    return member("relayout_us", "{" + results + "}");
+}
+
+} // namespace bench
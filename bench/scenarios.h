@@ -0,0 +1,67 @@
+#ifndef BENCH_SCENARIOS_H
+#define BENCH_SCENARIOS_H
+
+#include <string>
+
+#include "harness.h"
+
+namespace bench
+{
+
+// Every scenario returns its results as the members of a JSON object.
+
+/***
+ * @description: Start the WM with Options::adopt_windows mapped windows and
+ * time until all of them are framed, restarting the WM for every run
+ * @param {Session} &session with the display started and no WM running
+ * @return {string} "adoption_ms"
+ */
+std::string adoptionScenario(Session &session);
+
+/***
+ * @description: Map Options::windows windows one after another and time the
+ * MapRequest until the client is reparented and mapped
+ * @param {Session} &session with the WM running
+ * @return {string} "map_to_visible_us"
+ */
+std::string mapScenario(Session &session);
+
+/***
+ * @description: Alt+Button1 drag a window with XTEST, one motion at a time for
+ * the latency and back to back for the throughput
+ * @param {Session} &session with the WM running
+ * @return {string} "motion_to_move_us", "drag_configures_per_second",
+ * "drag_motions_per_second"
+ */
+std::string dragScenario(Session &session);
+
+/***
+ * @description: Close windows with the close key binding and time the
+ * WM_DELETE_WINDOW message and the frame's destruction
+ * @param {Session} &session with the WM running
+ * @return {string} "close_message_us", "close_to_unframed_us"
+ */
+std::string closeScenario(Session &session);
+
+/***
+ * @description: Fill two desktops with Options::desktop_windows windows each
+ * and switch between them with _NET_CURRENT_DESKTOP messages, timing the
+ * message until the WM published the new desktop, which it does after all
+ * the frames of the switch were mapped and unmapped
+ * @param {Session} &session with the WM running
+ * @return {string} "desktop_switch_us"
+ */
+std::string desktopScenario(Session &session);
+
+/***
+ * @description: Time the layout computation alone, without any display: the
+ * geometry of Options::layout_windows windows and the diff against the
+ * previous result, with a window added and removed in turns
+ * @param {Options} &options of the benchmark
+ * @return {string} "relayout_us", an object with a member per layout
+ */
+std::string layoutScenario(const Options &options);
+
+} // namespace bench
+
+#endif // BENCH_SCENARIOS_H
@@ -0,0 +1,121 @@
+#ifndef ATOMS_H
+#define ATOMS_H
+
+extern "C" {
+#include <xcb/xcb.h>
+}
+#include <array>
+#include <cstddef>
+
+namespace x11
+{
+
+// Every atom the WM uses, as (identifier, atom name).
+// Add new atoms here, they are interned together with all the others.
+#define TINYWM_ATOMS(X)                                                     \
+    X(UTF8_STRING, "UTF8_STRING")                                           \
+    X(WM_PROTOCOLS, "WM_PROTOCOLS")                                         \
+    X(WM_DELETE_WINDOW, "WM_DELETE_WINDOW")                                 \
+    X(WM_TAKE_FOCUS, "WM_TAKE_FOCUS")                                       \
+    X(WM_STATE, "WM_STATE")                                                 \
+    X(WM_CHANGE_STATE, "WM_CHANGE_STATE")                                   \
+    X(WM_CLIENT_LEADER, "WM_CLIENT_LEADER")                                 \
+    X(WM_WINDOW_ROLE, "WM_WINDOW_ROLE")                                     \
+    X(NET_SUPPORTED, "_NET_SUPPORTED")                                      \
+    X(NET_SUPPORTING_WM_CHECK, "_NET_SUPPORTING_WM_CHECK")                  \
+    X(NET_CLIENT_LIST, "_NET_CLIENT_LIST")                                  \
+    X(NET_CLIENT_LIST_STACKING, "_NET_CLIENT_LIST_STACKING")                \
+    X(NET_NUMBER_OF_DESKTOPS, "_NET_NUMBER_OF_DESKTOPS")                    \
+    X(NET_DESKTOP_GEOMETRY, "_NET_DESKTOP_GEOMETRY")                        \
+    X(NET_DESKTOP_VIEWPORT, "_NET_DESKTOP_VIEWPORT")                        \
+    X(NET_CURRENT_DESKTOP, "_NET_CURRENT_DESKTOP")                          \
+    X(NET_DESKTOP_NAMES, "_NET_DESKTOP_NAMES")                              \
+    X(NET_ACTIVE_WINDOW, "_NET_ACTIVE_WINDOW")                              \
+    X(NET_WORKAREA, "_NET_WORKAREA")                                        \
+    X(NET_SHOWING_DESKTOP, "_NET_SHOWING_DESKTOP")                          \
+    X(NET_CLOSE_WINDOW, "_NET_CLOSE_WINDOW")                                \
+    X(NET_MOVERESIZE_WINDOW, "_NET_MOVERESIZE_WINDOW")                      \
+    X(NET_WM_MOVERESIZE, "_NET_WM_MOVERESIZE")                              \
+    X(NET_RESTACK_WINDOW, "_NET_RESTACK_WINDOW")                            \
+    X(NET_REQUEST_FRAME_EXTENTS, "_NET_REQUEST_FRAME_EXTENTS")              \
+    X(NET_WM_NAME, "_NET_WM_NAME")                                          \
+    X(NET_WM_VISIBLE_NAME, "_NET_WM_VISIBLE_NAME")                          \
+    X(NET_WM_ICON_NAME, "_NET_WM_ICON_NAME")                                \
+    X(NET_WM_VISIBLE_ICON_NAME, "_NET_WM_VISIBLE_ICON_NAME")                \
+    X(NET_WM_DESKTOP, "_NET_WM_DESKTOP")                                    \
+    X(NET_WM_WINDOW_TYPE, "_NET_WM_WINDOW_TYPE")                            \
+    X(NET_WM_WINDOW_TYPE_DESKTOP, "_NET_WM_WINDOW_TYPE_DESKTOP")            \
+    X(NET_WM_WINDOW_TYPE_DOCK, "_NET_WM_WINDOW_TYPE_DOCK")                  \
+    X(NET_WM_WINDOW_TYPE_TOOLBAR, "_NET_WM_WINDOW_TYPE_TOOLBAR")            \
+    X(NET_WM_WINDOW_TYPE_MENU, "_NET_WM_WINDOW_TYPE_MENU")                  \
+    X(NET_WM_WINDOW_TYPE_UTILITY, "_NET_WM_WINDOW_TYPE_UTILITY")            \
+    X(NET_WM_WINDOW_TYPE_SPLASH, "_NET_WM_WINDOW_TYPE_SPLASH")              \
+    X(NET_WM_WINDOW_TYPE_DIALOG, "_NET_WM_WINDOW_TYPE_DIALOG")              \
+    X(NET_WM_WINDOW_TYPE_DROPDOWN_MENU, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU") \
+    X(NET_WM_WINDOW_TYPE_POPUP_MENU, "_NET_WM_WINDOW_TYPE_POPUP_MENU")      \
+    X(NET_WM_WINDOW_TYPE_TOOLTIP, "_NET_WM_WINDOW_TYPE_TOOLTIP")            \
+    X(NET_WM_WINDOW_TYPE_NOTIFICATION, "_NET_WM_WINDOW_TYPE_NOTIFICATION")  \
+    X(NET_WM_WINDOW_TYPE_COMBO, "_NET_WM_WINDOW_TYPE_COMBO")                \
+    X(NET_WM_WINDOW_TYPE_DND, "_NET_WM_WINDOW_TYPE_DND")                    \
+    X(NET_WM_WINDOW_TYPE_NORMAL, "_NET_WM_WINDOW_TYPE_NORMAL")              \
+    X(NET_WM_STATE, "_NET_WM_STATE")                                        \
+    X(NET_WM_STATE_MODAL, "_NET_WM_STATE_MODAL")                            \
+    X(NET_WM_STATE_STICKY, "_NET_WM_STATE_STICKY")                          \
+    X(NET_WM_STATE_MAXIMIZED_VERT, "_NET_WM_STATE_MAXIMIZED_VERT")          \
+    X(NET_WM_STATE_MAXIMIZED_HORZ, "_NET_WM_STATE_MAXIMIZED_HORZ")          \
+    X(NET_WM_STATE_SHADED, "_NET_WM_STATE_SHADED")                          \
+    X(NET_WM_STATE_SKIP_TASKBAR, "_NET_WM_STATE_SKIP_TASKBAR")              \
+    X(NET_WM_STATE_SKIP_PAGER, "_NET_WM_STATE_SKIP_PAGER")                  \
+    X(NET_WM_STATE_HIDDEN, "_NET_WM_STATE_HIDDEN")                          \
+    X(NET_WM_STATE_FULLSCREEN, "_NET_WM_STATE_FULLSCREEN")                  \
+    X(NET_WM_STATE_ABOVE, "_NET_WM_STATE_ABOVE")                            \
+    X(NET_WM_STATE_BELOW, "_NET_WM_STATE_BELOW")                            \
+    X(NET_WM_STATE_DEMANDS_ATTENTION, "_NET_WM_STATE_DEMANDS_ATTENTION")    \
+    X(NET_WM_STATE_FOCUSED, "_NET_WM_STATE_FOCUSED")                        \
+    X(NET_WM_ALLOWED_ACTIONS, "_NET_WM_ALLOWED_ACTIONS")                    \
+    X(NET_WM_STRUT, "_NET_WM_STRUT")                                        \
+    X(NET_WM_STRUT_PARTIAL, "_NET_WM_STRUT_PARTIAL")                        \
+    X(NET_WM_ICON_GEOMETRY, "_NET_WM_ICON_GEOMETRY")                        \
+    X(NET_WM_ICON, "_NET_WM_ICON")                                          \
+    X(NET_WM_PID, "_NET_WM_PID")                                            \
+    X(NET_WM_USER_TIME, "_NET_WM_USER_TIME")                                \
+    X(NET_FRAME_EXTENTS, "_NET_FRAME_EXTENTS")                              \
+    X(NET_WM_PING, "_NET_WM_PING")                                          \
+    X(NET_WM_SYNC_REQUEST, "_NET_WM_SYNC_REQUEST")                          \
+    X(NET_WM_SYNC_REQUEST_COUNTER, "_NET_WM_SYNC_REQUEST_COUNTER")
+
+enum class Atom : size_t {
+#define TINYWM_ATOM_ENUM(id, name) id,
+    TINYWM_ATOMS(TINYWM_ATOM_ENUM)
+#undef TINYWM_ATOM_ENUM
+    COUNT
+};
+
+/***
+ * @description: Table of all atoms in TINYWM_ATOMS, indexed by Atom.
+ */
+class Atoms
+{
+public:
+    /***
+     * @description: Intern every atom with one pipelined burst: all requests
+     * are sent before the first reply is awaited, so the whole table costs
+     * about one round trip.
+     * @param {xcb_connection_t} *c connection to the X server
+     * @return {*}
+     */
+    void intern(xcb_connection_t *c);
+
+    xcb_atom_t operator[](Atom atom) const noexcept
+    {
+        return atoms_[static_cast<size_t>(atom)];
+    }
+    static const char *name(Atom atom) noexcept;
+
+private:
+    std::array<xcb_atom_t, static_cast<size_t>(Atom::COUNT)> atoms_{};
+};
+
+} // namespace x11
+
+#endif // ATOMS_H
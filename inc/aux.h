@@ -7,10 +7,16 @@ extern "C" {
 #include <xcb/xcb.h>
 #include <xcb/xcb_aux.h>
 }
+#include <array>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 namespace x11
 {
-enum class KeyMap { ESC = 9 };
 enum class Colors : unsigned long {
     BLUE = 0x0000ff, // 蓝色
     RED = 0xff0000, // 黄色
@@ -18,15 +24,134 @@ enum class Colors : unsigned long {
     GREEN = 0xa0e93a, // 绿色
 };
 
-void print_modifiers(uint32_t mask);
-xcb_gcontext_t gc_font_get(xcb_connection_t *c, xcb_screen_t *screen,
-                           xcb_window_t window, const char *font_name);
-void text_draw(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
+// Metrics of an opened font, queried once when it is opened.
+struct FontInfo
+{
+    xcb_font_t font;
+    int16_t ascent;
+    int16_t descent;
+    uint16_t min_char;
+    uint16_t max_char;
+    int16_t default_width; // width of characters without their own entry
+    std::vector<int16_t> widths; // indexed by character - min_char
+};
+
+/***
+ * @description: Long-lived server resources for drawing decorations.
+ * Fonts are opened and measured once, GCs are created once per
+ * (font, foreground, background), so drawing is only fire-and-forget requests.
+ */
+class DecorationCache
+{
+public:
+    DecorationCache(xcb_connection_t *c, xcb_screen_t *screen,
+                    const char *default_font);
+    ~DecorationCache();
+
+    DecorationCache(const DecorationCache &) = delete;
+    DecorationCache &operator=(const DecorationCache &) = delete;
+
+    /***
+     * @description: Get a font, opening it and querying its metrics on first use.
+     * A font which can't be opened is replaced with "fixed", or with the
+     * server's default font (FontInfo::font XCB_NONE) if even that fails.
+     * @param {const char} *name of the font, nullptr for the default font
+     * @return {const FontInfo &}
+     */
+    const FontInfo &font(const char *name = nullptr);
+    /***
+     * @description: Get a GC drawing with the font and colors
+     * @param {uint32_t} fg foreground pixel
+     * @param {uint32_t} bg background pixel
+     * @param {const char} *font_name nullptr for the default font
+     * @return {xcb_gcontext_t}
+     */
+    xcb_gcontext_t gc(uint32_t fg, uint32_t bg, const char *font_name = nullptr);
+    xcb_gcontext_t gc() { return gc(screen_->black_pixel, screen_->white_pixel); }
+    uint16_t textWidth(const char *text, size_t length, const char *font_name = nullptr);
+    uint16_t textWidth(const std::string &text, const char *font_name = nullptr)
+    {
+        return textWidth(text.data(), text.size(), font_name);
+    }
+
+    xcb_connection_t *connection() const { return conn_; }
+
+private:
+    // Open a font and read its metrics, false if the server has no such font.
+    bool open(const std::string &name, FontInfo &info);
+
+    xcb_connection_t *conn_;
+    xcb_screen_t *screen_;
+    const std::string default_font_;
+    std::unordered_map<std::string, FontInfo> fonts_;
+    std::map<std::tuple<xcb_font_t, uint32_t, uint32_t>, xcb_gcontext_t> gcs_;
+};
+
+enum class CursorType : size_t {
+    NORMAL,
+    MOVE,
+    RESIZE_TOP_LEFT,
+    RESIZE_TOP,
+    RESIZE_TOP_RIGHT,
+    RESIZE_RIGHT,
+    RESIZE_BOTTOM_RIGHT,
+    RESIZE_BOTTOM,
+    RESIZE_BOTTOM_LEFT,
+    RESIZE_LEFT,
+    HAND,
+    COUNT
+};
+
+/***
+ * @description: All cursors the WM uses, created once from the cursor font.
+ * Frames and grabs refer to them, so the pointer crossing windows costs nothing.
+ */
+class CursorTable
+{
+public:
+    explicit CursorTable(xcb_connection_t *c);
+    ~CursorTable();
+
+    CursorTable(const CursorTable &) = delete;
+    CursorTable &operator=(const CursorTable &) = delete;
+
+    xcb_cursor_t operator[](CursorType shape) const noexcept
+    {
+        return cursors_[static_cast<size_t>(shape)];
+    }
+
+private:
+    xcb_connection_t *conn_;
+    std::array<xcb_cursor_t, static_cast<size_t>(CursorType::COUNT)> cursors_;
+};
+
+const char *event_name(uint8_t response_type);
+void text_draw(DecorationCache &cache, xcb_drawable_t drawable,
                int16_t x1, int16_t y1, const char *label);
-void button_draw(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
+void button_draw(DecorationCache &cache, xcb_drawable_t drawable,
                  int16_t x1, int16_t y1, const char *label);
-void cursor_set(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
-                int cursor_id);
+/***
+ * @description: Draw a title bar: background, bottom edge, centred title and
+ * close button
+ * @param {DecorationCache} &cache to draw with
+ * @param {xcb_drawable_t} drawable the title bar is drawn at the top of
+ * @param {uint16_t} width of the title bar
+ * @param {uint16_t} height of the title bar
+ * @param {const std::string} &title to show, cut to fit
+ * @param {bool} focused draws the title bar highlighted
+ * @return {*}
+ */
+void decoration_draw(DecorationCache &cache, xcb_drawable_t drawable,
+                     uint16_t width, uint16_t height, const std::string &title,
+                     bool focused);
+/***
+ * @description: Convert UTF-8 text for the core fonts, which are Latin-1:
+ * characters beyond U+00FF and broken sequences become '?', one byte per
+ * character, so the result can be cut anywhere
+ * @param {const std::string} &utf8 text
+ * @return {std::string} the same text in Latin-1
+ */
+std::string latin1_from_utf8(const std::string &utf8);
 uint32_t transRGB(uint32_t red, uint32_t green, uint32_t blue, uint32_t alpha);
 
 } // namespace x11
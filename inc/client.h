@@ -0,0 +1,130 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+extern "C" {
+#include <xcb/xcb.h>
+#include <xcb/sync.h>
+#include <xcb/xcb_icccm.h>
+}
+#include <array>
+#include <list>
+#include <string>
+
+#include "utils.hpp"
+
+namespace x11
+{
+
+// Decoration of the frames.
+constexpr uint16_t FRAME_BORDER_WIDTH = 5;
+constexpr uint16_t TITLE_HEIGHT = 18;
+
+/***
+ * @description: Everything the WM knows about a managed window.
+ * The record is kept current from the WM's own requests and from
+ * ConfigureNotify/MapNotify/UnmapNotify, so the input handlers never have to
+ * ask the server for geometry or hierarchy.
+ */
+struct Client
+{
+    xcb_window_t window = XCB_NONE;
+    xcb_window_t frame = XCB_NONE;
+    // Geometry of the frame in root coordinates, without its border.
+    utils::Position<int16_t> frame_pos{0, 0};
+    utils::Size<uint16_t> frame_size{0, 0};
+    uint16_t frame_border = 0;
+    // Geometry of the client window, relative to its frame.
+    utils::Position<int16_t> pos{0, 0};
+    utils::Size<uint16_t> size{0, 0};
+    uint16_t border_width = 0; // of the client window itself
+    bool mapped = false;
+    bool focused = false;
+    uint32_t desktop = 0; // _NET_WM_DESKTOP
+    // UnmapNotify of the client caused by the WM hiding it, not by the client.
+    unsigned ignore_unmaps = 0;
+    // The sibling frame directly below our frame, XCB_NONE if bottom-most.
+    xcb_window_t above_sibling = XCB_NONE;
+    // Position in the stacking order of the frames.
+    std::list<xcb_window_t>::iterator stack_entry;
+
+    // A synthetic ConfigureNotify is queued, to tell the client where it is
+    // after its frame moved.
+    bool configure_notify = false;
+
+    // Title bar rendered by the WM, installed as the frame's background.
+    xcb_pixmap_t decoration = XCB_NONE;
+    uint16_t decoration_width = 0;
+
+    // Cached ICCCM/EWMH properties, all read at map time and then only the
+    // ones a PropertyNotify reports as changed.
+    std::string wm_name; // WM_NAME, in Latin-1
+    std::string net_wm_name; // _NET_WM_NAME, UTF-8
+    // _NET_WM_NAME if the client has one, WM_NAME otherwise, in Latin-1 like
+    // the core font of the title bar.
+    std::string title;
+    std::string instance_name, class_name; // WM_CLASS
+    bool input = true; // WM_HINTS: set_input_focus gives it the focus
+    bool urgent = false; // WM_HINTS
+    xcb_size_hints_t normal_hints{}; // WM_NORMAL_HINTS, no flags if unset
+    bool delete_window = false; // WM_PROTOCOLS contains WM_DELETE_WINDOW
+    bool take_focus = false; // WM_PROTOCOLS contains WM_TAKE_FOCUS
+    bool sync_request = false; // WM_PROTOCOLS contains _NET_WM_SYNC_REQUEST
+    xcb_sync_counter_t sync_counter = XCB_NONE; // _NET_WM_SYNC_REQUEST_COUNTER
+    xcb_window_t transient_for = XCB_NONE; // WM_TRANSIENT_FOR
+    xcb_atom_t window_type = XCB_NONE; // first of _NET_WM_WINDOW_TYPE
+    // Dialogs and other transient windows keep their place in tiled layouts.
+    bool floating = false;
+
+    // Fires once the sync counter reaches sync_value, i.e. the client has
+    // painted the last size it was sent. Created on the first sync request.
+    xcb_sync_alarm_t sync_alarm = XCB_NONE;
+    uint64_t sync_value = 0;
+
+    // Position in the most recently used focus order of its desktop.
+    std::list<xcb_window_t>::iterator focus_entry;
+};
+
+// Properties of a client cached in its record.
+enum class ClientProperty : uint8_t {
+    WM_NAME,
+    NET_WM_NAME,
+    WM_CLASS,
+    WM_HINTS,
+    WM_NORMAL_HINTS,
+    WM_PROTOCOLS,
+    WM_TRANSIENT_FOR,
+    NET_WM_WINDOW_TYPE,
+    NET_WM_SYNC_REQUEST_COUNTER,
+    COUNT
+};
+
+// Property requests sent for a window before it gets framed, so that their
+// replies can be read together with the other replies of the same batch.
+struct PropertyCookies
+{
+    std::array<xcb_get_property_cookie_t, static_cast<size_t>(ClientProperty::COUNT)> cookies;
+
+    xcb_get_property_cookie_t &operator[](ClientProperty property) noexcept
+    {
+        return cookies[static_cast<size_t>(property)];
+    }
+    const xcb_get_property_cookie_t &operator[](ClientProperty property) const noexcept
+    {
+        return cookies[static_cast<size_t>(property)];
+    }
+};
+
+/***
+ * @description: The size closest to a wanted one that a client accepts, after
+ * the min/max size and the resize increments of its WM_NORMAL_HINTS, as
+ * described in ICCCM 4.1.2.3. Aspect ratios are not applied.
+ * @param {xcb_size_hints_t} &hints of the client
+ * @param {int} width wanted for the client window
+ * @param {int} height wanted for the client window
+ * @return {Size<uint16_t>} at least 1x1
+ */
+utils::Size<uint16_t> constrain_size(const xcb_size_hints_t &hints, int width, int height);
+
+} // namespace x11
+
+#endif // CLIENT_H
@@ -0,0 +1,53 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstdint>
+#include <string>
+
+#include "layout.h"
+
+namespace x11
+{
+
+// How a window follows the pointer while it is resized.
+enum class ResizeMode : uint8_t {
+    OUTLINE, // a rectangle drawn on the root, the window is resized on release
+    FRAME, // the frame follows, the client is resized on release
+    LIVE, // frame and client follow
+};
+
+/***
+ * @description: Runtime settings of the WM.
+ * Every field has a default, and can be overridden by an environment variable
+ * named in its comment.
+ */
+struct Config
+{
+    // Frame configures per second while dragging a window, usually the refresh
+    // rate of the output. 0 applies every batch of motion at once.
+    // TINYWM_MOTION_RATE
+    unsigned motion_rate = 60;
+    // Unix socket serving the event loop metrics as JSON, none if empty.
+    // TINYWM_METRICS_SOCKET
+    std::string metrics_socket;
+    // Layout at startup: floating, master-stack, grid or monocle.
+    // TINYWM_LAYOUT
+    Layout layout = Layout::FLOATING;
+    // Number of virtual desktops, at least 1.
+    // TINYWM_DESKTOPS
+    unsigned desktops = 4;
+    // Resize mode: outline, frame or live.
+    // TINYWM_RESIZE_MODE
+    ResizeMode resize_mode = ResizeMode::LIVE;
+    // Client configures per second during a live resize, for clients which
+    // can't tell when they have painted with _NET_WM_SYNC_REQUEST. 0 sends
+    // every size the pointer asks for.
+    // TINYWM_RESIZE_RATE
+    unsigned resize_rate = 30;
+
+    static Config fromEnvironment();
+};
+
+} // namespace x11
+
+#endif // CONFIG_H
@@ -0,0 +1,110 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+extern "C" {
+#include <xcb/xcb.h>
+#include <xcb/xcb_keysyms.h>
+}
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace x11
+{
+
+// What a key binding does.
+enum class Action : uint8_t {
+    NONE,
+    CLOSE_WINDOW,
+    NEXT_WINDOW, // cycle the focus through the most recently used windows
+    PREVIOUS_WINDOW,
+    NEXT_LAYOUT,
+    SWITCH_DESKTOP, // to the desktop in the argument
+    MOVE_TO_DESKTOP, // the focused window, to the desktop in the argument
+};
+
+// What a key press does, e.g. {SWITCH_DESKTOP, 2}.
+struct Command
+{
+    Action action;
+    uint8_t argument;
+};
+
+struct KeyBinding
+{
+    uint16_t modifiers; // XCB_MOD_MASK_*, without lock modifiers
+    xcb_keysym_t keysym;
+    Action action;
+    uint8_t argument; // 0 if left out
+};
+
+// The bindings of the WM.
+const std::vector<KeyBinding> &default_bindings();
+
+/***
+ * @description: Key bindings compiled into a flat table.
+ * The keyboard and modifier mappings are read once and again only on
+ * MappingNotify, so looking up a key press costs no round trip and no
+ * allocation. Lock modifiers (CapsLock, NumLock, ScrollLock) are ignored in
+ * the lookup and grabbed in every combination.
+ */
+class Keyboard
+{
+public:
+    Keyboard(xcb_connection_t *c, const std::vector<KeyBinding> &bindings);
+    ~Keyboard();
+
+    Keyboard(const Keyboard &) = delete;
+    Keyboard &operator=(const Keyboard &) = delete;
+
+    /***
+     * @description: Reload the mappings after the keyboard changed
+     * @param {xcb_mapping_notify_event_t} *ev the MappingNotify
+     * @return {bool} true if the grabs need to be registered again
+     */
+    bool refresh(xcb_mapping_notify_event_t *ev);
+    /***
+     * @description: Action bound to a key press
+     * @param {xcb_keycode_t} keycode of the event
+     * @param {uint16_t} state of the event, lock modifiers included
+     * @return {Command} Action::NONE if the key is not bound
+     */
+    Command lookup(xcb_keycode_t keycode, uint16_t state) const noexcept
+    {
+        return table_[keycode << 8 | (state & mask_)];
+    }
+    // Modifier masks a key is mapped to, 0 for keys which are no modifier.
+    uint8_t modifiersOf(xcb_keycode_t keycode) const noexcept { return modifiers_of_[keycode]; }
+    // Lock modifier masks of this keyboard, e.g. LockMask | NumLock.
+    uint16_t locks() const noexcept { return locks_; }
+    /***
+     * @description: Every combination of the lock modifiers, to be OR-ed into
+     * a passive grab, so that the grab works with any lock modifier on
+     * @return {const vector<uint16_t> &} starting with 0
+     */
+    const std::vector<uint16_t> &lockCombinations() const noexcept { return lock_combinations_; }
+    // (keycode, modifiers) of every binding, lock combinations not included.
+    const std::vector<std::pair<xcb_keycode_t, uint16_t>> &grabs() const noexcept { return grabs_; }
+    // Keycodes currently producing a keysym, empty if none does.
+    std::vector<xcb_keycode_t> keycodes(xcb_keysym_t keysym) const;
+
+private:
+    // Read the lock modifiers and compile the bindings into the table.
+    void compile();
+
+    xcb_connection_t *conn_;
+    xcb_key_symbols_t *symbols_;
+    const std::vector<KeyBinding> bindings_;
+    // Indexed by keycode << 8 | modifiers, modifiers without the locks.
+    std::array<Command, 256 * 256> table_;
+    std::array<uint8_t, 256> modifiers_of_;
+    uint16_t locks_ = XCB_MOD_MASK_LOCK;
+    uint16_t mask_ = 0xff & ~XCB_MOD_MASK_LOCK; // modifiers the bindings can use
+    std::vector<uint16_t> lock_combinations_;
+    std::vector<std::pair<xcb_keycode_t, uint16_t>> grabs_;
+};
+
+} // namespace x11
+
+#endif // KEYS_H
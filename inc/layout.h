@@ -0,0 +1,85 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace x11
+{
+
+// How the mapped clients are placed.
+enum class Layout : uint8_t {
+    FLOATING, // wherever the clients and the user put them
+    MASTER_STACK, // master windows on the left, the others stacked on the right
+    GRID,
+    MONOCLE, // every window fills the area
+};
+
+// "floating", "master-stack", "grid" or "monocle".
+const char *layout_name(Layout layout);
+// The layout after this one, in the order of the enum.
+Layout next_layout(Layout layout);
+/***
+ * @description: Parse a layout name
+ * @param {const char} *name as returned by layout_name()
+ * @param {Layout} &layout set if the name is known
+ * @return {bool} false if the name is unknown
+ */
+bool parse_layout(const char *name, Layout &layout);
+
+struct Rect
+{
+    int16_t x = 0, y = 0;
+    uint16_t width = 0, height = 0;
+
+    Rect() = default;
+    Rect(int16_t _x, int16_t _y, uint16_t w, uint16_t h)
+        : x(_x)
+        , y(_y)
+        , width(w)
+        , height(h)
+    {
+    }
+    bool operator==(const Rect &other) const noexcept
+    {
+        return x == other.x && y == other.y && width == other.width && height == other.height;
+    }
+    bool operator!=(const Rect &other) const noexcept { return !(*this == other); }
+};
+
+struct LayoutParams
+{
+    Rect area; // usable part of the screen, in root coordinates
+    unsigned masters = 1; // windows in the master column
+    double master_ratio = 0.55; // width of the master column
+    uint16_t gap = 0; // between the frames and around them
+    uint16_t border = 0; // border width of a frame
+    uint16_t title = 0; // title bar height of a frame
+};
+
+// Where a layout puts a client.
+struct Placement
+{
+    Rect frame; // in root coordinates, without the border
+    Rect client; // relative to the frame
+};
+
+/***
+ * @description: Compute the geometry of every tiled window at once.
+ * A pure function of its arguments: it doesn't touch the X connection, so
+ * that it can be benchmarked headless and its result diffed against what is
+ * on screen before anything is sent.
+ * @param {Layout} layout to compute, FLOATING places nothing
+ * @param {LayoutParams} &params area and decoration
+ * @param {size_t} count windows to place, masters first
+ * @param {vector<Placement>} &placements resized to count, reused between
+ * calls so that a relayout allocates nothing
+ * @return {*}
+ */
+void arrange(Layout layout, const LayoutParams &params, size_t count,
+             std::vector<Placement> &placements);
+
+} // namespace x11
+
+#endif // LAYOUT_H
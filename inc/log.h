@@ -0,0 +1,147 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// Records below this level are compiled out: 0 DEBUG, 1 INFO, 2 WARNING, 3 ERROR.
+#ifndef TINYWM_LOG_LEVEL
+#define TINYWM_LOG_LEVEL 1
+#endif
+
+/***
+ * @description: Log from the event loop without blocking it.
+ * The format is a string literal with a "{}" per argument ("{x}" for hex).
+ * Arguments are integers, string literals or other strings of static storage,
+ * and std::string, whose bytes are copied into the record.
+ * e.g. WM_LOG(INFO, "Framed window {} [{}]", w, frame);
+ */
+#define WM_LOG(level, ...)                                                                   \
+    do {                                                                                     \
+        if (static_cast<int>(::x11::LogLevel::level) >= TINYWM_LOG_LEVEL)                    \
+            ::x11::Logger::instance().write(::x11::LogLevel::level, __VA_ARGS__);            \
+    } while (0)
+
+namespace x11
+{
+
+enum class LogLevel : uint8_t { DEBUG, INFO, WARNING, ERROR };
+
+/***
+ * @description: Fixed-size binary log record, formatted by the logging thread
+ */
+struct LogRecord
+{
+    enum ArgType : uint8_t { SIGNED, UNSIGNED, STATIC_STRING, TEXT };
+    static constexpr size_t MAX_ARGS = 6;
+    static constexpr size_t TEXT_SIZE = 48;
+
+    std::chrono::system_clock::time_point time;
+    const char *format;
+    LogLevel level;
+    uint8_t arg_count;
+    uint8_t text_length;
+    std::array<ArgType, MAX_ARGS> types;
+    // Integer value, string pointer, or offset << 8 | length into text.
+    std::array<uint64_t, MAX_ARGS> args;
+    char text[TEXT_SIZE];
+};
+
+/***
+ * @description: Single-producer single-consumer ring of log records.
+ * The event loop is the only producer. It never waits: when the ring is full
+ * the record is dropped and counted. A background thread is the consumer,
+ * formatting the records and writing them to stderr.
+ */
+class Logger
+{
+public:
+    static Logger &instance();
+
+    // Start or stop the background thread. Records left are written by stop().
+    void start();
+    void stop();
+
+    template<typename... Args>
+    void write(LogLevel level, const char *format, const Args &...args) noexcept
+    {
+        static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "too many log arguments");
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == CAPACITY) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogRecord &record = ring_[head & (CAPACITY - 1)];
+        record.time = std::chrono::system_clock::now();
+        record.format = format;
+        record.level = level;
+        record.arg_count = 0;
+        record.text_length = 0;
+        pack(record, args...);
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    // Must be a power of two.
+    static constexpr size_t CAPACITY = 4096;
+
+    Logger() = default;
+    ~Logger();
+
+    static void pack(LogRecord &) noexcept {}
+    template<typename T, typename... Rest>
+    static void pack(LogRecord &record, const T &arg, const Rest &...rest) noexcept
+    {
+        packOne(record, arg);
+        pack(record, rest...);
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    packOne(LogRecord &record, const T &arg) noexcept
+    {
+        const bool is_signed = std::is_signed<T>::value;
+        record.types[record.arg_count] = is_signed ? LogRecord::SIGNED : LogRecord::UNSIGNED;
+        record.args[record.arg_count++] =
+            is_signed ? static_cast<uint64_t>(static_cast<int64_t>(arg)) : static_cast<uint64_t>(arg);
+    }
+    static void packOne(LogRecord &record, const char *arg) noexcept
+    {
+        record.types[record.arg_count] = LogRecord::STATIC_STRING;
+        record.args[record.arg_count++] = reinterpret_cast<uintptr_t>(arg);
+    }
+    static void packOne(LogRecord &record, const std::string &arg) noexcept
+    {
+        // Cut to what is left of the text buffer.
+        const size_t offset = record.text_length;
+        const size_t length = std::min(arg.size(), LogRecord::TEXT_SIZE - offset);
+        memcpy(record.text + offset, arg.data(), length);
+        record.text_length += length;
+        record.types[record.arg_count] = LogRecord::TEXT;
+        record.args[record.arg_count++] = offset << 8 | length;
+    }
+
+    void run();
+    // Append a formatted record to the output buffer.
+    static void format(const LogRecord &record, std::string &out);
+
+    std::array<LogRecord, CAPACITY> ring_;
+    // Producer and consumer indices, on their own cache lines.
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
+
+} // namespace x11
+
+#endif // LOG_H
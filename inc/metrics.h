@@ -0,0 +1,145 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace x11
+{
+
+/***
+ * @description: HDR-style histogram of latencies in ns, or of other counts.
+ * Buckets are log-linear: every power of two is split into 32 buckets, so a
+ * recorded value is kept with about 3% precision from 1ns up to minutes,
+ * with fixed memory and O(1) recording.
+ */
+class Histogram
+{
+public:
+    void record(uint64_t ns) noexcept;
+    uint64_t count() const noexcept { return count_; }
+    uint64_t max() const noexcept { return max_; }
+    double mean() const noexcept;
+    /***
+     * @description: Value below which the given share of the records fall
+     * @param {double} quantile between 0 and 1
+     * @return {uint64_t} upper bound of the bucket in ns
+     */
+    uint64_t quantile(double quantile) const noexcept;
+
+private:
+    static constexpr unsigned SUB_BUCKET_BITS = 5;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    // Values up to 2^36 ns (about 68 s), longer ones land in the last bucket.
+    static constexpr unsigned MAX_EXPONENT = 36;
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    static size_t bucketOf(uint64_t ns) noexcept;
+    static uint64_t upperBoundOf(size_t bucket) noexcept;
+
+    std::array<uint32_t, BUCKETS> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+/***
+ * @description: Counters of the event loop, per event type.
+ * dispatch() brackets every handler with begin()/end(); the counters in
+ * between are charged to the event being handled, or to "loop" outside of
+ * any handler.
+ */
+class Metrics
+{
+public:
+    struct EventStats
+    {
+        uint64_t count = 0;
+        Histogram handler_time;
+        // Blocking waits for a reply, one per burst of pipelined requests.
+        uint64_t round_trips = 0;
+        uint64_t requests = 0; // void requests sent
+        uint64_t flushes = 0; // xcb_flush() calls, not bytes: XCB doesn't tell
+
+        uint64_t queue_depth_sum = 0; // events queued behind this one on entry
+        uint64_t queue_depth_max = 0;
+    };
+
+    Metrics();
+
+    /***
+     * @description: Start charging the counters to an event type
+     * @param {uint8_t} response_type of the event being handled
+     * @param {size_t} queue_depth events still queued behind it
+     * @return {*}
+     */
+    void begin(uint8_t response_type, size_t queue_depth) noexcept;
+    // Start charging the counters to a motion tick applying the given windows.
+    void beginTick(size_t windows) noexcept;
+    // Record the handler time and charge the loop again.
+    void end() noexcept;
+
+    void roundTrip() noexcept { ++current_->round_trips; }
+    void request() noexcept { ++current_->requests; }
+    void flush() noexcept { ++current_->flushes; }
+    /***
+     * @description: Count a batch of events read from the connection together
+     * @param {size_t} events in the batch as read
+     * @param {size_t} coalesced events merged into others or dropped
+     * @return {*}
+     */
+    void batch(size_t events, size_t coalesced) noexcept;
+
+    // Human-readable table, one line per event type.
+    std::string toText() const;
+    // The same as a JSON object, for tools.
+    std::string toJson() const;
+
+private:
+    EventStats &stats(uint8_t response_type);
+    void start(EventStats &stats, size_t queue_depth) noexcept;
+    static void appendText(std::string &out, const char *name, const EventStats &stats);
+    static void appendJson(std::string &out, const char *name, const EventStats &stats);
+    double flushesPerSecond() const noexcept;
+
+    const std::chrono::steady_clock::time_point start_;
+    // Indexed by response type without the "sent" bit, allocated on first use.
+    std::array<std::unique_ptr<EventStats>, 128> events_;
+    EventStats tick_; // coalesced motion applied once per frame
+    Histogram batch_sizes_;
+    uint64_t coalesced_ = 0;
+    EventStats loop_;
+    EventStats *current_;
+    std::chrono::steady_clock::time_point handler_start_;
+};
+
+/***
+ * @description: Unix socket serving Metrics::toJson() to every connection,
+ * e.g. `socat - UNIX-CONNECT:path`. The event loop polls fd() and calls
+ * serve() when it is readable.
+ */
+class MetricsSocket
+{
+public:
+    explicit MetricsSocket(const std::string &path);
+    ~MetricsSocket();
+
+    MetricsSocket(const MetricsSocket &) = delete;
+    MetricsSocket &operator=(const MetricsSocket &) = delete;
+
+    // -1 if the socket could not be set up.
+    int fd() const noexcept { return fd_; }
+    void serve(const Metrics &metrics);
+
+private:
+    const std::string path_;
+    int fd_;
+};
+
+} // namespace x11
+
+#endif // METRICS_H
@@ -0,0 +1,87 @@
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+
+extern "C" {
+#include <xcb/xcb.h>
+}
+#include <cstdint>
+#include <vector>
+
+#include "layout.h"
+#include "metrics.h"
+
+namespace x11
+{
+
+// A visible part of the root window, e.g. a monitor.
+struct Output
+{
+    uint32_t id; // RandR monitor name or CRTC, 0 for the whole root
+    Rect rect; // in root coordinates
+    bool primary;
+};
+
+/***
+ * @description: Cached table of the outputs showing the root window.
+ * Read once at startup and kept current from the RandR events: a CRTC change
+ * is applied in place without a round trip, anything else marks the table
+ * stale and it is read again once, on the next update(). Uses RandR 1.5
+ * monitors when the server has them, so that monitors set up with
+ * `xrandr --setmonitor` on Xvfb or Xephyr count like real ones, and falls back
+ * to the active CRTCs, then to the whole root without RandR.
+ */
+class Outputs
+{
+public:
+    Outputs(xcb_connection_t *c, xcb_screen_t *screen, Metrics &metrics);
+
+    Outputs(const Outputs &) = delete;
+    Outputs &operator=(const Outputs &) = delete;
+
+    /***
+     * @description: Apply a RandR event to the table
+     * @param {xcb_generic_event_t} *event any event
+     * @return {bool} false if it is no RandR event
+     */
+    bool handle(const xcb_generic_event_t *event);
+    /***
+     * @description: Read the table again if an event made it stale
+     * @return {bool} true if the outputs changed since the last update()
+     */
+    bool update();
+
+    // Never empty.
+    const std::vector<Output> &outputs() const noexcept { return outputs_; }
+    // The primary output, or the first one if none is.
+    const Output &primary() const noexcept;
+    // Output containing a point, nullptr if the point is not visible.
+    const Output *at(int16_t x, int16_t y) const noexcept;
+    /***
+     * @description: Where to put a window so that it can be seen. A window
+     * showing enough of itself on some output stays, any other one is moved
+     * to fit into the output nearest to it.
+     * @param {Rect} &outer geometry of the window, border included
+     * @return {Rect} outer, moved if needed, with the same size
+     */
+    Rect clamp(const Rect &outer) const noexcept;
+
+private:
+    // Query the whole table, with the requests sent together.
+    void refresh();
+    void refreshMonitors();
+    void refreshCrtcs();
+
+    xcb_connection_t *conn_;
+    const xcb_window_t root_;
+    Metrics &metrics_;
+    uint8_t first_event_ = 0; // of RandR, 0 without the extension
+    bool monitors_ = false; // RandR 1.5
+    Rect root_rect_; // size of the root, following RRScreenChangeNotify
+    std::vector<Output> outputs_;
+    bool stale_ = false;
+    bool changed_ = false;
+};
+
+} // namespace x11
+
+#endif // OUTPUTS_H
@@ -0,0 +1,55 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+extern "C" {
+#include <xcb/xcb.h>
+}
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace x11
+{
+
+/***
+ * @description: Ring of in-flight void requests.
+ * Requests are sent without the `_checked()` suffix, so their errors arrive in
+ * the event queue. The ring maps the sequence number of such an error back to
+ * the handler and the message of the request which caused it.
+ */
+class RequestTracker
+{
+public:
+    struct Request
+    {
+        uint32_t sequence;
+        const char *message; // what the request was meant to do
+        const char *origin; // the handler which issued it
+    };
+
+    /***
+     * @description: Remember a request, overwriting the oldest slot
+     * @param {xcb_void_cookie_t} cookie of the unchecked request
+     * @param {const char} *message describing the request
+     * @param {const char} *origin handler issuing the request
+     * @return {*}
+     */
+    void track(xcb_void_cookie_t cookie, const char *message,
+               const char *origin) noexcept;
+    /***
+     * @description: Look up the request an error belongs to
+     * @param {uint32_t} sequence full sequence number of the error
+     * @return {const Request *} nullptr if the request is unknown or was
+     * overwritten already
+     */
+    const Request *find(uint32_t sequence) const noexcept;
+
+private:
+    // Must be a power of two, so that a sequence number maps to a slot by masking.
+    static constexpr size_t CAPACITY = 1024;
+    std::array<Request, CAPACITY> ring_{};
+};
+
+} // namespace x11
+
+#endif // REQUEST_H
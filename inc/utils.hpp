@@ -3,8 +3,8 @@
 
 #include <algorithm>
 #include <ostream>
-#include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 // Declarations
@@ -57,33 +57,49 @@ struct Vector2D
 namespace utils
 {
 
+// Numbers go through std::to_string, everything else through its toString().
+namespace detail
+{
 template<typename T>
-std::string Size<T>::toString() const
+std::string toString(const T &x, std::true_type)
 {
-    std::ostringstream out;
-    out << width << 'x' << height;
-    return out.str();
+    return std::to_string(x);
 }
 template<typename T>
-std::string Position<T>::toString() const
+std::string toString(const T &x, std::false_type)
 {
-    std::ostringstream out;
-    out << "(" << x << ", " << y << ")";
-    return out.str();
+    return x.toString();
 }
+} // namespace detail
+
 template<typename T>
-std::string Vector2D<T>::toString() const
+std::string toString(const T &x)
+{
+    return detail::toString(x, std::is_arithmetic<T>());
+}
+inline std::string toString(const std::string &x)
 {
-    std::ostringstream out;
-    out << "(" << x << ", " << y << ")";
-    return out.str();
+    return x;
 }
+inline std::string toString(const char *x)
+{
+    return x;
+}
+
 template<typename T>
-std::string toString(const T &x)
+std::string Size<T>::toString() const
 {
-    std::ostringstream out;
-    out << x;
-    return out.str();
+    return utils::toString(width) + 'x' + utils::toString(height);
+}
+template<typename T>
+std::string Position<T>::toString() const
+{
+    return "(" + utils::toString(x) + ", " + utils::toString(y) + ")";
+}
+template<typename T>
+std::string Vector2D<T>::toString() const
+{
+    return "(" + utils::toString(x) + ", " + utils::toString(y) + ")";
 }
 
 template<typename T>
@@ -140,27 +156,25 @@ Size<T> operator-(const Size<T> &a, const Vector2D<T> &v)
     return Size<T>(a.width - v.x, a.height - v.y);
 }
 
-template<typename Container>
-std::string Join(const Container &container, const std::string &delimiter)
+template<typename Container, typename Converter>
+std::string Join(const Container &container, const std::string &delimiter,
+                 Converter converter)
 {
-    std::ostringstream out;
+    std::string out;
     for (auto i = container.cbegin(); i != container.cend(); ++i) {
         if (i != container.cbegin()) {
-            out << delimiter;
+            out += delimiter;
         }
-        out << *i;
+        out += converter(*i);
     }
-    return out.str();
+    return out;
 }
 
-template<typename Container, typename Converter>
-std::string Join(const Container &container, const std::string &delimiter,
-                 Converter converter)
+template<typename Container>
+std::string Join(const Container &container, const std::string &delimiter)
 {
-    std::vector<std::string> converted_container(container.size());
-    std::transform(container.cbegin(), container.cend(),
-                   converted_container.begin(), converter);
-    return Join(converted_container, delimiter);
+    typedef typename Container::value_type Value;
+    return Join(container, delimiter, [](const Value &value) { return toString(value); });
 }
 
 } // namespace utils
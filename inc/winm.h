@@ -5,11 +5,24 @@ extern "C" {
 #include <xcb/xcb.h>
 }
 #include <atomic>
+#include <chrono>
+#include <csignal>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "atoms.h"
+#include "aux.h"
+#include "client.h"
+#include "config.h"
+#include "keys.h"
+#include "layout.h"
+#include "metrics.h"
+#include "outputs.h"
+#include "request.h"
 #include "utils.hpp"
 
 namespace x11
@@ -20,7 +33,7 @@ class WindowManager
 public:
     ~WindowManager();
     static std::unique_ptr<WindowManager> getInstance(
-        const std::string &display_name = "");
+        const std::string &display_name = "", const Config &config = Config());
 
     WindowManager(WindowManager &&wm) noexcept = delete;
     WindowManager &operator=(WindowManager &&wm) noexcept = delete;
@@ -32,21 +45,137 @@ public:
     void run();
 
 private:
-    explicit WindowManager(xcb_connection_t *c, xcb_screen_t *s);
+    explicit WindowManager(xcb_connection_t *c, xcb_screen_t *s,
+                           const Config &config);
+    /***
+     * @description: Hand an event to its handler
+     * @param {xcb_generic_event_t} *event to be handled
+     * @param {size_t} queue_depth events read together with it and still waiting
+     * @return {*}
+     */
+    void dispatch(xcb_generic_event_t *event, size_t queue_depth);
+    /***
+     * @description: Collapse the work a later event of the same batch makes
+     * redundant: ConfigureRequests of a window are merged into the last one,
+     * and a MapRequest or ConfigureRequest of a window which is unmapped or
+     * destroyed later in the batch is dropped
+     * @param {vector<xcb_generic_event_t *>} &batch events in arrival order,
+     * dropped events are freed and removed
+     * @return {size_t} number of events removed
+     */
+    size_t coalesce(std::vector<xcb_generic_event_t *> &batch);
+    // xcb_flush(), counted in the metrics.
+    void flush();
+    // Log the metrics when SIGUSR1 was received.
+    void dumpMetrics();
+    /***
+     * @description: Apply the newest motion of every window, at most once per
+     * frame of Config::motion_rate
+     * @param {bool} apply even if the frame is not due yet
+     * @return {int} milliseconds until the next frame is due, -1 if nothing waits
+     */
+    int applyMotions(bool force);
+    /***
+     * @description: Place the tiled clients by the current layout. Geometries
+     * are computed for all of them at once, and configures are only queued
+     * for the frames and clients which move or change size.
+     * @return {*}
+     */
+    void relayout();
+    // Bring every window showing too little of itself onto an output, after
+    // the outputs changed.
+    void placeOnOutputs();
+    // EWMH
+    // Create the _NET_SUPPORTING_WM_CHECK window and set _NET_SUPPORTED.
+    void initEwmh();
+    /***
+     * @description: Write the EWMH root properties which changed since the
+     * last call, once per event batch. A list which only grew at its end is
+     * extended with XCB_PROP_MODE_APPEND instead of being rewritten.
+     * @return {*}
+     */
+    void publishEwmh();
+    /***
+     * @description: Write a window list property if it differs from what was
+     * written last
+     * @param {Atom} property to write on the root
+     * @param {vector<xcb_window_t>} &current value
+     * @param {vector<xcb_window_t>} &published last value written, updated
+     * @return {*}
+     */
+    void publishList(Atom property, const std::vector<xcb_window_t> &current,
+                     std::vector<xcb_window_t> &published);
     // Reparenting/Framing
     /***
-     * @description: Frame a window
-     * @param {xcb_window_t} window to be framed
-     * @param {bool} does the window was created before wm
+     * @description: Frame all visible windows which were created before wm,
+     * with the server grabbed. The attributes of all windows are requested at
+     * once, then the geometry and properties of the ones to frame, and the
+     * frames are sent as one batch.
      * @return {*}
      */
-    void addFrame(xcb_window_t w, bool created_before);
+    void adoptWindows();
+    /***
+     * @description: Frame a window, only queueing the requests without flush
+     * @param {xcb_window_t} window to be framed
+     * @param {xcb_get_geometry_reply_t} *geometry of the window
+     * @param {PropertyCookies} &cookies of the window's properties
+     * @return {Client &} record of the new client
+     */
+    Client &addFrame(xcb_window_t w, const xcb_get_geometry_reply_t *result_geo,
+                     const PropertyCookies &cookies);
     /***
      * @description: UnFrame a window
      * @param {xcb_window_t} window to be framed
+     * @param {bool} destroyed the window is gone, nothing is left to clean on it
      * @return {*}
      */
-    void unFrame(xcb_window_t w);
+    void unFrame(xcb_window_t w, bool destroyed);
+
+    // Client records
+    /***
+     * @description: Follow the property changes of a window to be framed and
+     * send the requests for all the properties cached in its record at once
+     * @param {xcb_window_t} window to be framed
+     * @return {PropertyCookies} cookies to pass to readProperties()
+     */
+    PropertyCookies requestProperties(xcb_window_t w);
+    void readProperties(Client &client, const PropertyCookies &cookies);
+    // For a window which vanished before it could be framed.
+    void discardProperties(const PropertyCookies &cookies);
+    xcb_get_property_cookie_t requestProperty(xcb_window_t w, ClientProperty property);
+    xcb_atom_t propertyAtom(ClientProperty property) const noexcept;
+    /***
+     * @description: Store a property of the client in its record
+     * @param {Client} &client whose property was read
+     * @param {ClientProperty} property which was read
+     * @param {xcb_get_property_reply_t} *reply nullptr if it was deleted
+     * @return {bool} true if the title changed
+     */
+    bool applyProperty(Client &client, ClientProperty property,
+                       const xcb_get_property_reply_t *reply);
+    // Read the properties re-fetched by the batch, all requests are out already.
+    void readPendingProperties();
+    /***
+     * @description: Look up a client by its own window or by its frame
+     * @param {xcb_window_t} client or frame window
+     * @return {Client *} nullptr if the window is not managed
+     */
+    Client *findClient(xcb_window_t w);
+
+    // Stacking
+    // Raise the frame of a client to the top.
+    void raise(Client &client);
+    /***
+     * @description: Put frames into an order, each one directly above the one
+     * before it. Configures relative to the sibling are only queued for the
+     * frames which are not there yet, unmanaged windows are skipped.
+     * @param {vector<xcb_window_t>} &order clients, bottom first
+     * @return {*}
+     */
+    void restack(const std::vector<xcb_window_t> &order);
+    // Move a client in the local stacking order only, directly above another
+    // client or to the bottom if below is nullptr.
+    void stackAbove(Client &client, const Client *below);
 
     // Callbacks
     void onClientMessage(xcb_client_message_event_t *ev);
@@ -63,32 +192,204 @@ private:
     void onLeaveNotify(xcb_leave_notify_event_t *ev);
 
     void onExpose(xcb_expose_event_t *ev);
+    void onPropertyNotify(xcb_property_notify_event_t *ev);
+    /***
+     * @description: Render the title bar into the frame's background pixmap,
+     * after the title, the focus or the width of the frame changed
+     * @param {Client} &client whose decoration is rendered
+     * @return {*}
+     */
+    void renderDecoration(Client &client);
     void onResizeRequest(xcb_resize_request_event_t *ev);
     void onFocusIn(xcb_focus_in_event_t *ev);
     void onFocusOut(xcb_focus_out_event_t *ev);
     void onButtonPress(xcb_button_press_event_t *ev);
     void onButtonRelease(xcb_button_release_event_t *ev);
     void onKeyPress(xcb_key_press_event_t *ev);
+    /***
+     * @description: Ask a client to close with WM_DELETE_WINDOW, or kill it
+     * if it doesn't support the protocol
+     * @param {Client} &client to close
+     * @param {xcb_timestamp_t} time of the user action
+     * @return {*}
+     */
+    void closeClient(const Client &client, xcb_timestamp_t time);
     void onKeyRelease(xcb_key_release_event_t *ev);
+    /***
+     * @description: Step the Alt+Tab cycle through the focus order, raising
+     * the window it arrives at. The keyboard is grabbed while the cycle lasts.
+     * @param {bool} forward towards less recently used windows
+     * @param {xcb_timestamp_t} time of the key press
+     * @param {uint16_t} modifiers of the binding, releasing one ends the cycle
+     * @return {*}
+     */
+    void cycleFocus(bool forward, xcb_timestamp_t time, uint16_t modifiers);
+    // Raise a client and give it the input focus, in one batch.
+    void focusClient(Client &client, xcb_timestamp_t time);
+    // Focus the most recently used window of the current desktop, if any.
+    void focusLastUsed(xcb_timestamp_t time);
 
+    // Desktops
+    // Most recently used first, the clients of the current desktop.
+    std::list<xcb_window_t> &focusOrder() { return focus_order_[current_desktop_]; }
+    /***
+     * @description: Show another desktop: its frames are mapped and the
+     * frames of the current one unmapped, as one batch of requests
+     * @param {uint32_t} desktop to show, ignored if out of range
+     * @param {xcb_timestamp_t} time of the user action
+     * @return {*}
+     */
+    void switchDesktop(uint32_t desktop, xcb_timestamp_t time);
+    void moveToDesktop(Client &client, uint32_t desktop);
+    // Map or unmap the frame and the client, counting the unmap as ours.
+    void show(Client &client);
+    void hide(Client &client);
+    // Reload the keyboard mapping and grab the key bindings again.
+    void onMappingNotify(xcb_mapping_notify_event_t *ev);
+    /***
+     * @description: Grab the button and key bindings on the root, in all lock
+     * modifier combinations
+     * @return {*}
+     */
+    void grabBindings();
+    void grabKeys();
+    /***
+     * @description: Move or resize the dragged client for a pointer position
+     * @param {Client} &client being dragged
+     * @param {Position<int16_t>} &drag_pos pointer position in root coordinates
+     * @param {uint16_t} state of the buttons and modifiers
+     * @param {bool} done the button was released
+     * @return {*}
+     */
+    void dragTo(Client &client, const utils::Position<int16_t> &drag_pos,
+                uint16_t state, bool done);
+    /***
+     * @description: Resize the dragged client as Config::resize_mode says
+     * @param {Client} &client being resized
+     * @param {Size<uint16_t>} &size of the client window, size hints applied
+     * @param {bool} done the drag ends, frame and client get their final size
+     * @return {*}
+     */
+    void resizeTo(Client &client, const utils::Size<uint16_t> &size, bool done);
+    /***
+     * @description: Move the resize outline, erasing the old one and drawing
+     * the new one with the server grabbed for just these two requests
+     * @param {Rect} &outline in root coordinates, border included, empty to
+     * erase the outline
+     * @return {*}
+     */
+    void drawOutline(const Rect &outline);
+    /***
+     * @description: Send the live resized client the size it was last
+     * dragged to, as soon as it can take it: after its sync counter answered
+     * the previous size with _NET_WM_SYNC_REQUEST, after
+     * Config::resize_rate otherwise
+     * @param {bool} force send it now, e.g. when the drag ends
+     * @return {int} milliseconds until it can be sent, -1 if nothing waits
+     */
+    int applyResize(bool force);
+    // Ask the client to update its sync counter once it painted the next size.
+    void sendSyncRequest(Client &client);
+    void onSyncAlarm(xcb_sync_alarm_notify_event_t *ev);
+    /***
+     * @description: Tell a client where it is after its frame moved. Only
+     * queued: every client gets one synthetic ConfigureNotify per pass of the
+     * event loop, however often the batch and the motion tick moved it
+     * @param {Client} &client whose frame moved
+     * @return {*}
+     */
+    void queueConfigureNotify(Client &client);
+    // Send the queued ConfigureNotify, built from the client records.
+    void sendConfigureNotifies();
+    /***
+     * @description: Report an error of an unchecked request, which arrives in
+     * the event queue instead of being returned by xcb_request_check()
+     * @param {xcb_generic_error_t} *error from the event queue
+     * @return {*}
+     */
+    void onError(xcb_generic_error_t *error);
+
+    // Errors of replies are fatal, the caller can't go on without the reply.
     inline void errorHandler(xcb_generic_error_t *error,
                              const char *message) const noexcept;
+    // Void requests are only tracked, their errors are reported by onError().
     inline void errorHandler(xcb_void_cookie_t cookie,
-                             const char *message) const noexcept;
+                             const char *message) noexcept;
     // Geometerys
+    xcb_window_t drag_window_ = XCB_NONE; // client being dragged
+    xcb_window_t focused_ = XCB_NONE; // client with the input focus
+    // Managed clients per desktop, most recently focused first.
+    std::vector<std::list<xcb_window_t>> focus_order_;
+    uint32_t current_desktop_ = 0;
+    // Window shown by an Alt+Tab cycle in progress, XCB_NONE if none is.
+    xcb_window_t cycle_target_ = XCB_NONE;
+    uint16_t cycle_modifiers_ = 0;
+    std::vector<xcb_window_t> cycle_stacking_; // restored when the cycle ends
     utils::Position<int16_t> drag_start_pos_;
     utils::Position<int16_t> drag_start_frame_pos_;
     utils::Size<int16_t> drag_start_frame_size_;
+    xcb_gcontext_t outline_gc_ = XCB_NONE; // XORs the resize outline on the root
+    Rect outline_; // shown by an outline resize, empty if none is
+    // Live resize of the dragged client, paced by the client.
+    utils::Size<uint16_t> resize_target_;
+    bool resize_waiting_ = false; // resize_target_ is not sent yet
+    bool sync_waiting_ = false; // the last sync request is unanswered
+    std::chrono::steady_clock::time_point resize_sent_;
+    uint8_t sync_event_ = 0; // first event of SYNC, 0 without the extension
+    std::vector<xcb_window_t> configure_notifies_; // queued by queueConfigureNotify()
+
+    // Tiling
+    Layout layout_;
+    std::vector<xcb_window_t> tile_order_; // framed clients, oldest first
+    std::vector<Placement> placements_; // reused by every relayout
+    bool relayout_ = false; // clients or layout changed since the last one
+
+    // Properties re-fetched after a PropertyNotify, read once the batch is
+    // dispatched. One request per window and property, however many events.
+    struct PendingProperty
+    {
+        xcb_window_t window;
+        ClientProperty property;
+        xcb_get_property_cookie_t cookie;
+    };
+    std::vector<PendingProperty> pending_properties_;
+
+    // Newest motion per window, waiting for the next frame.
+    std::unordered_map<xcb_window_t, xcb_motion_notify_event_t> motions_;
+    std::chrono::steady_clock::time_point next_motion_;
 
     // Attributes
     // const xcb_atom_t XCB_PROPERTY_DELETE;
+    const Config config_;
     xcb_connection_t *conn;
     xcb_screen_t *screen;
     const xcb_window_t root;
-    std::unordered_map<xcb_window_t, xcb_window_t> clients_;
-    const xcb_atom_t WM_PROTOCOLS; // 窗管协议族这个属性对应的原子
-    const xcb_atom_t WM_DELETE_WINDOW; // 窗管关闭窗口协议这个属性对应的原子
+    std::unordered_map<xcb_window_t, Client> clients_;
+    std::unordered_map<xcb_window_t, xcb_window_t> frames_; // frame -> client
+    // Clients in the stacking order of their frames, bottom first. Kept from
+    // our own restacks and from ConfigureNotify, so it is never queried.
+    std::list<xcb_window_t> stacking_;
+
+    // EWMH root properties, as last written.
+    xcb_window_t wm_check_ = XCB_NONE; // _NET_SUPPORTING_WM_CHECK
+    std::vector<xcb_window_t> published_clients_; // _NET_CLIENT_LIST
+    std::vector<xcb_window_t> published_stacking_; // _NET_CLIENT_LIST_STACKING
+    xcb_window_t published_active_ = XCB_WINDOW_NONE; // _NET_ACTIVE_WINDOW
+    uint32_t published_desktop_ = 0; // _NET_CURRENT_DESKTOP
+    std::vector<xcb_window_t> scratch_list_; // reused to build the lists
+    bool clients_dirty_ = true; // the lists may differ from the published ones
+    bool stacking_dirty_ = true;
+    RequestTracker requests_;
+    std::unique_ptr<DecorationCache> decorations_;
+    std::unique_ptr<CursorTable> cursors_;
+    std::unique_ptr<Keyboard> keyboard_;
+    std::unique_ptr<Outputs> outputs_;
+    const char *dispatching_; // name of the event being handled
+    Metrics metrics_;
+    std::unique_ptr<MetricsSocket> metrics_socket_;
+    Atoms atoms_;
     static std::atomic<bool> wm_detected_;
+    static volatile sig_atomic_t dump_metrics_; // set by SIGUSR1
     static std::mutex wm_mutex_;
     static WindowManager *instance_;
 };
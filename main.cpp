@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <glog/logging.h>
+#include "inc/log.h"
 #include "inc/winm.h"
 
 inline void errorStackPrinter(const char *str, size_t size) {
@@ -12,15 +13,18 @@ int main(int argc, char **argv) {
     ::google::InstallFailureWriter(
         errorStackPrinter); // 安装配置程序失败信号的信息打印过程，设置回调函数
     ::google::InitGoogleLogging(argv[0]);
+    x11::Logger::instance().start(); // 事件循环的日志由后台线程输出
 
     ::std::unique_ptr<x11::WindowManager> window_manager =
-        x11::WindowManager::getInstance(); // CLI参数留空，使用DISPLAY环境变量
+        x11::WindowManager::getInstance(
+            "", x11::Config::fromEnvironment()); // 显示名留空，使用DISPLAY环境变量
     if (!window_manager) {
         LOG(ERROR) << "Failed to initialize window manager.";
         return EXIT_FAILURE;
     }
 
     window_manager->run();
+    x11::Logger::instance().stop();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include "atoms.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <glog/logging.h>
+
+namespace x11
+{
+
+namespace
+{
+
+constexpr const char *ATOM_NAMES[] = {
+#define TINYWM_ATOM_NAME(id, name) name,
+    TINYWM_ATOMS(TINYWM_ATOM_NAME)
+#undef TINYWM_ATOM_NAME
+};
+static_assert(sizeof(ATOM_NAMES) / sizeof(ATOM_NAMES[0]) == static_cast<size_t>(Atom::COUNT),
+              "every atom needs a name");
+
+} // namespace
+
+void Atoms::intern(xcb_connection_t *c)
+{
+    constexpr size_t count = static_cast<size_t>(Atom::COUNT);
+    // 1. Send all the requests, creating atoms which don't exist yet.
+    std::array<xcb_intern_atom_cookie_t, count> cookies;
+    for (size_t i = 0; i < count; ++i)
+        cookies[i] = xcb_intern_atom(c, 0, strlen(ATOM_NAMES[i]), ATOM_NAMES[i]);
+    // 2. Collect the replies.
+    for (size_t i = 0; i < count; ++i) {
+        xcb_generic_error_t *error = nullptr;
+        xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(c, cookies[i], &error);
+        if (reply == nullptr) {
+            LOG(ERROR) << "intern atom " << ATOM_NAMES[i] << " failed. : "
+                       << (error ? static_cast<int>(error->error_code) : 0);
+            free(error);
+            atoms_[i] = XCB_ATOM_NONE;
+            continue;
+        }
+        atoms_[i] = reply->atom;
+        free(reply);
+    }
+}
+
+const char *Atoms::name(Atom atom) noexcept
+{
+    return ATOM_NAMES[static_cast<size_t>(atom)];
+}
+
+} // namespace x11
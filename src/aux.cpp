@@ -2,121 +2,198 @@
 
 #include <xcb/xproto.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include "log.h"
+
 namespace x11
 {
 
-void print_modifiers(uint32_t mask)
+DecorationCache::DecorationCache(xcb_connection_t *c, xcb_screen_t *screen,
+                                 const char *default_font)
+    : conn_(c)
+    , screen_(screen)
+    , default_font_(default_font)
 {
-    const char **mod,
-        *mods[] = {"Shift", "Lock", "Ctrl", "Alt", "Mod2",
-                   "Mod3", "Mod4", "Mod5", "Button1", "Button2",
-                   "Button3", "Button4", "Button5"};
-    printf("Modifier mask: ");
-    for (mod = mods; mask; mask >>= 1, mod++)
-        if (mask & 1)
-            printf(*mod);
-    putchar('\n');
 }
 
-xcb_gcontext_t gc_font_get(xcb_connection_t *c, xcb_screen_t *screen,
-                           xcb_window_t window, const char *font_name)
+DecorationCache::~DecorationCache()
 {
-    uint32_t value_list[3];
-    xcb_void_cookie_t cookie_font;
-    xcb_void_cookie_t cookie_gc;
-    xcb_generic_error_t *error;
-    xcb_font_t font;
-    xcb_gcontext_t gc;
-    uint32_t mask;
-
-    font = xcb_generate_id(c);
-    cookie_font = xcb_open_font_checked(c, font, strlen(font_name), font_name);
-
-    error = xcb_request_check(c, cookie_font);
-    if (error) {
-        fprintf(stderr, "ERROR: can't open font : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
+    for (const auto &gc : gcs_)
+        xcb_free_gc(conn_, gc.second);
+    for (const auto &font : fonts_) {
+        if (font.second.font != XCB_NONE)
+            xcb_close_font(conn_, font.second.font);
     }
+}
 
-    gc = xcb_generate_id(c);
-    mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT;
-    value_list[0] = screen->black_pixel;
-    value_list[1] = screen->white_pixel;
-    value_list[2] = font;
-    cookie_gc = xcb_create_gc_checked(c, gc, window, mask, value_list);
-    error = xcb_request_check(c, cookie_gc);
-    if (error) {
-        fprintf(stderr, "ERROR: can't create gc : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
+const FontInfo &DecorationCache::font(const char *name)
+{
+    const std::string font_name = name ? name : default_font_;
+    auto found = fonts_.find(font_name);
+    if (found != fonts_.end())
+        return found->second;
 
-    cookie_font = xcb_close_font_checked(c, font);
-    error = xcb_request_check(c, cookie_font);
-    if (error) {
-        fprintf(stderr, "ERROR: can't close font : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
+    FontInfo info;
+    if (open(font_name, info))
+        return fonts_[font_name] = info;
+    WM_LOG(ERROR, "Can't open font {}, falling back to fixed", font_name);
+    if (font_name != "fixed" && open("fixed", info))
+        return fonts_[font_name] = info;
+    // Leave the font of the GCs unset, with the metrics of the old
+    // hard-coded 7x13 font.
+    WM_LOG(ERROR, "Can't open font fixed, using the server's default font");
+    info.font = XCB_NONE;
+    info.ascent = 11;
+    info.descent = 2;
+    info.min_char = info.max_char = 0;
+    info.default_width = 7;
+    info.widths.clear();
+    return fonts_[font_name] = info;
+}
+
+bool DecorationCache::open(const std::string &name, FontInfo &info)
+{
+    // Open the font and ask for its metrics in the same round trip. A failed
+    // OpenFont leaves the id unused, QueryFont on it fails as well.
+    info.font = xcb_generate_id(conn_);
+    xcb_open_font(conn_, info.font, name.size(), name.c_str());
+    xcb_query_font_reply_t *result_font =
+        xcb_query_font_reply(conn_, xcb_query_font(conn_, info.font), nullptr);
+    if (result_font == nullptr)
+        return false;
+    info.ascent = result_font->font_ascent;
+    info.descent = result_font->font_descent;
+    info.min_char = result_font->min_char_or_byte2;
+    info.max_char = result_font->max_char_or_byte2;
+    info.default_width = result_font->max_bounds.character_width;
+    // No per-character metrics means every character is as wide as max_bounds.
+    const xcb_charinfo_t *char_infos = xcb_query_font_char_infos(result_font);
+    const int char_infos_len = xcb_query_font_char_infos_length(result_font);
+    info.widths.clear();
+    info.widths.reserve(char_infos_len);
+    for (int i = 0; i < char_infos_len; ++i)
+        info.widths.push_back(char_infos[i].character_width);
+    free(result_font);
+    return true;
+}
+
+xcb_gcontext_t DecorationCache::gc(uint32_t fg, uint32_t bg, const char *font_name)
+{
+    const xcb_font_t font_id = font(font_name).font;
+    const auto key = std::make_tuple(font_id, fg, bg);
+    auto found = gcs_.find(key);
+    if (found != gcs_.end())
+        return found->second;
 
+    const xcb_gcontext_t gc = xcb_generate_id(conn_);
+    // Without a font the GC keeps the server's default one.
+    const uint32_t mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND
+                          | (font_id != XCB_NONE ? XCB_GC_FONT : 0);
+    const uint32_t value_list[] = {fg, bg, font_id};
+    xcb_create_gc(conn_, gc, screen_->root, mask, value_list);
+    gcs_[key] = gc;
     return gc;
 }
 
-void text_draw(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
-               int16_t x1, int16_t y1, const char *label)
+uint16_t DecorationCache::textWidth(const char *text, size_t length,
+                                    const char *font_name)
 {
-    xcb_void_cookie_t cookie_gc;
-    xcb_void_cookie_t cookie_text;
-    xcb_generic_error_t *error;
-    xcb_gcontext_t gc;
-    uint8_t length;
-
-    length = strlen(label);
-
-    gc = gc_font_get(c, screen, window, "7x13");
-
-    cookie_text = xcb_image_text_8_checked(c, length, window, gc, x1, y1, label);
-    error = xcb_request_check(c, cookie_text);
-    if (error) {
-        fprintf(stderr, "ERROR: can't paste text : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
+    const FontInfo &info = font(font_name);
+    uint16_t width = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const uint16_t c = static_cast<unsigned char>(text[i]);
+        if (c >= info.min_char && static_cast<size_t>(c - info.min_char) < info.widths.size())
+            width += info.widths[c - info.min_char];
+        else
+            width += info.default_width;
     }
+    return width;
+}
+
+CursorTable::CursorTable(xcb_connection_t *c)
+    : conn_(c)
+{
+    // Glyphs of the X cursor font, in the order of CursorType.
+    static const uint16_t glyphs[] = {
+        68, // XC_left_ptr
+        52, // XC_fleur
+        134, // XC_top_left_corner
+        138, // XC_top_side
+        136, // XC_top_right_corner
+        96, // XC_right_side
+        14, // XC_bottom_right_corner
+        16, // XC_bottom_side
+        12, // XC_bottom_left_corner
+        70, // XC_left_side
+        58, // XC_hand1
+    };
+    static_assert(sizeof(glyphs) / sizeof(glyphs[0]) == static_cast<size_t>(CursorType::COUNT),
+                  "every cursor type needs a glyph");
 
-    cookie_gc = xcb_free_gc(c, gc);
-    error = xcb_request_check(c, cookie_gc);
-    if (error) {
-        fprintf(stderr, "ERROR: can't free gc : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
+    const xcb_font_t font = xcb_generate_id(conn_);
+    xcb_open_font(conn_, font, strlen("cursor"), "cursor");
+    for (size_t i = 0; i < cursors_.size(); ++i) {
+        cursors_[i] = xcb_generate_id(conn_);
+        // Black glyph with white outline, the mask is the next glyph in the font.
+        xcb_create_glyph_cursor(conn_, cursors_[i], font, font, glyphs[i],
+                                glyphs[i] + 1, 0, 0, 0, 0xffff, 0xffff, 0xffff);
     }
+    // The cursors keep what they need from the font.
+    xcb_close_font(conn_, font);
 }
-void button_draw(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
+
+CursorTable::~CursorTable()
+{
+    for (const xcb_cursor_t cursor : cursors_)
+        xcb_free_cursor(conn_, cursor);
+}
+
+const char *event_name(uint8_t response_type)
+{
+    static const char *names[] = {
+        "Error", "Reply", "KeyPress", "KeyRelease", "ButtonPress",
+        "ButtonRelease", "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn",
+        "FocusOut", "KeymapNotify", "Expose", "GraphicsExposure", "NoExposure",
+        "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify", "MapNotify",
+        "MapRequest", "ReparentNotify", "ConfigureNotify", "ConfigureRequest", "GravityNotify",
+        "ResizeRequest", "CirculateNotify", "CirculateRequest", "PropertyNotify", "SelectionClear",
+        "SelectionRequest", "SelectionNotify", "ColormapNotify", "ClientMessage", "MappingNotify"};
+    response_type &= ~0x80;
+    if (response_type < sizeof(names) / sizeof(names[0]))
+        return names[response_type];
+    return "Extension";
+}
+
+void text_draw(DecorationCache &cache, xcb_drawable_t drawable,
+               int16_t x1, int16_t y1, const char *label)
+{
+    const size_t length = std::min<size_t>(strlen(label), UINT8_MAX);
+    xcb_image_text_8(cache.connection(), length, drawable, cache.gc(), x1, y1,
+                     label);
+}
+
+void button_draw(DecorationCache &cache, xcb_drawable_t drawable,
                  int16_t x1, int16_t y1, const char *label)
 {
     xcb_point_t points[5];
-    xcb_void_cookie_t cookie_gc;
-    xcb_void_cookie_t cookie_line;
-    xcb_void_cookie_t cookie_text;
-    xcb_generic_error_t *error;
-    xcb_gcontext_t gc;
     int16_t width;
     int16_t height;
-    uint8_t length;
+    size_t length;
     int16_t inset;
 
-    length = strlen(label);
+    length = std::min<size_t>(strlen(label), UINT8_MAX);
     inset = 2;
 
-    gc = gc_font_get(c, screen, window, "7x13");
+    const FontInfo &font = cache.font();
+    const xcb_gcontext_t gc = cache.gc();
 
-    width = 7 * length + 2 * (inset + 1);
-    height = 13 + 2 * (inset + 1);
+    width = cache.textWidth(label, length) + 2 * (inset + 1);
+    height = font.ascent + font.descent + 2 * (inset + 1);
     points[0].x = x1;
     points[0].y = y1;
     points[1].x = x1 + width;
@@ -127,85 +204,90 @@ void button_draw(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
     points[3].y = y1 - height;
     points[4].x = x1;
     points[4].y = y1;
-    cookie_line =
-        xcb_poly_line_checked(c, XCB_COORD_MODE_ORIGIN, window, gc, 5, points);
-
-    error = xcb_request_check(c, cookie_line);
-    if (error) {
-        fprintf(stderr, "ERROR: can't draw lines : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
-
-    cookie_text = xcb_image_text_8_checked(c, length, window, gc, x1 + inset + 1,
-                                           y1 - inset - 1, label);
-    error = xcb_request_check(c, cookie_text);
-    if (error) {
-        fprintf(stderr, "ERROR: can't paste text : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
-
-    cookie_gc = xcb_free_gc(c, gc);
-    error = xcb_request_check(c, cookie_gc);
-    if (error) {
-        fprintf(stderr, "ERROR: can't free gc : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
+    xcb_poly_line(cache.connection(), XCB_COORD_MODE_ORIGIN, drawable, gc, 5,
+                  points);
+    xcb_image_text_8(cache.connection(), length, drawable, gc, x1 + inset + 1,
+                     y1 - inset - 1 - font.descent, label);
 }
-void cursor_set(xcb_connection_t *c, xcb_screen_t *screen, xcb_window_t window,
-                int cursor_id)
-{
-    uint32_t values_list[3];
-    xcb_void_cookie_t cookie_font;
-    xcb_void_cookie_t cookie_gc;
-    xcb_generic_error_t *error;
-    xcb_font_t font;
-    xcb_cursor_t cursor;
-    xcb_gcontext_t gc;
-    uint32_t mask;
-    uint32_t value_list;
-
-    font = xcb_generate_id(c);
-    cookie_font = xcb_open_font_checked(c, font, strlen("cursor"), "cursor");
-    error = xcb_request_check(c, cookie_font);
-    if (error) {
-        fprintf(stderr, "ERROR: can't open font : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
-
-    cursor = xcb_generate_id(c);
-    xcb_create_glyph_cursor(c, cursor, font, font, cursor_id, cursor_id + 1, 0, 0,
-                            0, 0, 0, 0);
-
-    gc = xcb_generate_id(c);
-    mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT;
-    values_list[0] = screen->black_pixel;
-    values_list[1] = screen->white_pixel;
-    values_list[2] = font;
-    cookie_gc = xcb_create_gc_checked(c, gc, window, mask, values_list);
-    error = xcb_request_check(c, cookie_gc);
-    if (error) {
-        fprintf(stderr, "ERROR: can't create gc : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
-    }
 
-    mask = XCB_CW_CURSOR;
-    value_list = cursor;
-    xcb_change_window_attributes(c, window, mask, &value_list);
-
-    xcb_free_cursor(c, cursor);
+void decoration_draw(DecorationCache &cache, xcb_drawable_t drawable,
+                     uint16_t width, uint16_t height, const std::string &title,
+                     bool focused)
+{
+    xcb_connection_t *c = cache.connection();
+    const uint32_t fg = 0x000000;
+    const uint32_t bg = static_cast<uint32_t>(focused ? Colors::GREEN : Colors::GREY);
+    const int16_t inset = 3;
+    // 1. Background, with an edge towards the client.
+    const xcb_rectangle_t bar = {0, 0, width, height};
+    xcb_poly_fill_rectangle(c, drawable, cache.gc(bg, bg), 1, &bar);
+    const xcb_point_t edge[] = {{0, static_cast<int16_t>(height - 1)},
+                                {static_cast<int16_t>(width - 1), static_cast<int16_t>(height - 1)}};
+    xcb_poly_line(c, XCB_COORD_MODE_ORIGIN, drawable, cache.gc(fg, bg), 2, edge);
+    // 2. Close button at the right end.
+    const int16_t box = height - 2 * inset;
+    const int16_t box_x = width - inset - box;
+    const xcb_rectangle_t button = {box_x, inset, static_cast<uint16_t>(box),
+                                    static_cast<uint16_t>(box)};
+    const xcb_segment_t cross[] = {
+        {static_cast<int16_t>(box_x + 2), inset + 2,
+         static_cast<int16_t>(box_x + box - 2), static_cast<int16_t>(inset + box - 2)},
+        {static_cast<int16_t>(box_x + 2), static_cast<int16_t>(inset + box - 2),
+         static_cast<int16_t>(box_x + box - 2), inset + 2}};
+    const xcb_gcontext_t gc = cache.gc(fg, bg);
+    xcb_poly_rectangle(c, drawable, gc, 1, &button);
+    xcb_poly_segment(c, drawable, gc, 2, cross);
+    // 3. Title, centred in the space left of the button and cut to fit.
+    const FontInfo &font = cache.font();
+    const int16_t room = box_x - 2 * inset;
+    size_t length = std::min<size_t>(title.size(), UINT8_MAX);
+    uint16_t text_width = cache.textWidth(title.data(), length);
+    while (length > 0 && text_width > room)
+        text_width = cache.textWidth(title.data(), --length);
+    const int16_t x = inset + std::max(0, (room - text_width) / 2);
+    const int16_t y = (height + font.ascent - font.descent) / 2;
+    xcb_image_text_8(c, length, drawable, gc, x, y, title.data());
+}
 
-    cookie_font = xcb_close_font_checked(c, font);
-    error = xcb_request_check(c, cookie_font);
-    if (error) {
-        fprintf(stderr, "ERROR: can't close font : %d\n", error->error_code);
-        xcb_disconnect(c);
-        exit(EXIT_FAILURE);
+std::string latin1_from_utf8(const std::string &utf8)
+{
+    std::string latin1;
+    latin1.reserve(utf8.size());
+    size_t i = 0;
+    while (i < utf8.size()) {
+        const unsigned char lead = utf8[i];
+        // Length of the sequence and the bits of the lead byte.
+        size_t length = 1;
+        uint32_t code = lead;
+        if (lead >= 0xf0 && lead < 0xf8) {
+            length = 4;
+            code = lead & 0x07;
+        } else if (lead >= 0xe0) {
+            length = 3;
+            code = lead & 0x0f;
+        } else if (lead >= 0xc0) {
+            length = 2;
+            code = lead & 0x1f;
+        } else if (lead >= 0x80) {
+            // A continuation byte without a lead.
+            latin1.push_back('?');
+            ++i;
+            continue;
+        }
+        size_t read = 1;
+        while (read < length && i + read < utf8.size()
+               && (static_cast<unsigned char>(utf8[i + read]) & 0xc0) == 0x80) {
+            code = code << 6 | (utf8[i + read] & 0x3f);
+            ++read;
+        }
+        // Nothing of a cut, broken or overlong sequence.
+        if (read < length || lead >= 0xf8 || (length > 1 && code < 0x80))
+            latin1.push_back('?');
+        else
+            latin1.push_back(code <= 0xff ? static_cast<char>(code) : '?');
+        i += read;
     }
+    return latin1;
 }
 
 uint32_t transRGB(uint32_t red, uint32_t green, uint32_t blue, uint32_t alpha)
@@ -0,0 +1,48 @@
+#include "client.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace x11
+{
+
+namespace
+{
+
+// One dimension of constrain_size().
+uint16_t constrain(int size, uint32_t flags, int32_t min, int32_t max, int32_t base, int32_t inc)
+{
+    // The base size stands in for a missing min size and the other way round.
+    const int32_t lower = std::max<int32_t>(
+        flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE ? min
+        : flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE ? base
+                                                : 1,
+        1);
+    const int32_t origin = flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE ? base
+                           : flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE ? min
+                                                                    : 0;
+    if ((flags & XCB_ICCCM_SIZE_HINT_P_MAX_SIZE) && max > 0)
+        size = std::min(size, max);
+    size = std::max(size, lower);
+    // A whole number of increments beyond the base, rounded down unless that
+    // goes below the min size.
+    if ((flags & XCB_ICCCM_SIZE_HINT_P_RESIZE_INC) && inc > 0 && size > origin) {
+        size = origin + (size - origin) / inc * inc;
+        if (size < lower)
+            size += (lower - size + inc - 1) / inc * inc;
+    }
+    return static_cast<uint16_t>(std::min<int>(size, UINT16_MAX));
+}
+
+} // namespace
+
+utils::Size<uint16_t> constrain_size(const xcb_size_hints_t &hints, int width, int height)
+{
+    return utils::Size<uint16_t>(
+        constrain(width, hints.flags, hints.min_width, hints.max_width, hints.base_width,
+                  hints.width_inc),
+        constrain(height, hints.flags, hints.min_height, hints.max_height, hints.base_height,
+                  hints.height_inc));
+}
+
+} // namespace x11
@@ -0,0 +1,75 @@
+#include "config.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <glog/logging.h>
+
+namespace x11
+{
+
+namespace
+{
+
+void readUnsigned(const char *name, unsigned &value)
+{
+    const char *env = getenv(name);
+    if (env == nullptr || *env == '\0')
+        return;
+    char *end = nullptr;
+    const unsigned long parsed = strtoul(env, &end, 10);
+    if (*end != '\0') {
+        LOG(WARNING) << "Ignore invalid " << name << "=" << env;
+        return;
+    }
+    value = static_cast<unsigned>(parsed);
+}
+
+void readString(const char *name, std::string &value)
+{
+    const char *env = getenv(name);
+    if (env != nullptr)
+        value = env;
+}
+
+void readLayout(const char *name, Layout &value)
+{
+    const char *env = getenv(name);
+    if (env == nullptr || *env == '\0')
+        return;
+    if (!parse_layout(env, value))
+        LOG(WARNING) << "Ignore invalid " << name << "=" << env;
+}
+
+void readResizeMode(const char *name, ResizeMode &value)
+{
+    static const char *const names[] = {"outline", "frame", "live"};
+    const char *env = getenv(name);
+    if (env == nullptr || *env == '\0')
+        return;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(env, names[i]) == 0) {
+            value = static_cast<ResizeMode>(i);
+            return;
+        }
+    }
+    LOG(WARNING) << "Ignore invalid " << name << "=" << env;
+}
+
+} // namespace
+
+Config Config::fromEnvironment()
+{
+    Config config;
+    readUnsigned("TINYWM_MOTION_RATE", config.motion_rate);
+    readString("TINYWM_METRICS_SOCKET", config.metrics_socket);
+    readLayout("TINYWM_LAYOUT", config.layout);
+    readUnsigned("TINYWM_DESKTOPS", config.desktops);
+    readResizeMode("TINYWM_RESIZE_MODE", config.resize_mode);
+    readUnsigned("TINYWM_RESIZE_RATE", config.resize_rate);
+    if (config.desktops == 0)
+        config.desktops = 1;
+    return config;
+}
+
+} // namespace x11
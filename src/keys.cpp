@@ -0,0 +1,130 @@
+#include "keys.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "log.h"
+
+namespace x11
+{
+
+namespace
+{
+
+// Keysyms from X11/keysymdef.h.
+constexpr xcb_keysym_t KEYSYM_SPACE = 0x0020;
+constexpr xcb_keysym_t KEYSYM_1 = 0x0031;
+constexpr xcb_keysym_t KEYSYM_TAB = 0xff09;
+constexpr xcb_keysym_t KEYSYM_SCROLL_LOCK = 0xff14;
+constexpr xcb_keysym_t KEYSYM_ESCAPE = 0xff1b;
+constexpr xcb_keysym_t KEYSYM_NUM_LOCK = 0xff7f;
+constexpr xcb_keysym_t KEYSYM_F4 = 0xffc1;
+
+} // namespace
+
+const std::vector<KeyBinding> &default_bindings()
+{
+    static const std::vector<KeyBinding> bindings = []() {
+        std::vector<KeyBinding> result = {
+            {XCB_MOD_MASK_1, KEYSYM_F4, Action::CLOSE_WINDOW, 0},
+            {XCB_MOD_MASK_CONTROL, KEYSYM_ESCAPE, Action::CLOSE_WINDOW, 0}, // the old binding
+            {XCB_MOD_MASK_1, KEYSYM_TAB, Action::NEXT_WINDOW, 0},
+            {XCB_MOD_MASK_1 | XCB_MOD_MASK_SHIFT, KEYSYM_TAB, Action::PREVIOUS_WINDOW, 0},
+            {XCB_MOD_MASK_1, KEYSYM_SPACE, Action::NEXT_LAYOUT, 0},
+        };
+        // Alt+1..9 switches to a desktop, Alt+Shift+1..9 sends the window there.
+        for (uint8_t desktop = 0; desktop < 9; ++desktop) {
+            result.push_back({XCB_MOD_MASK_1, KEYSYM_1 + desktop, Action::SWITCH_DESKTOP, desktop});
+            result.push_back({XCB_MOD_MASK_1 | XCB_MOD_MASK_SHIFT, KEYSYM_1 + desktop,
+                              Action::MOVE_TO_DESKTOP, desktop});
+        }
+        return result;
+    }();
+    return bindings;
+}
+
+Keyboard::Keyboard(xcb_connection_t *c, const std::vector<KeyBinding> &bindings)
+    : conn_(c)
+    , symbols_(xcb_key_symbols_alloc(c))
+    , bindings_(bindings)
+{
+    compile();
+}
+
+Keyboard::~Keyboard()
+{
+    xcb_key_symbols_free(symbols_);
+}
+
+bool Keyboard::refresh(xcb_mapping_notify_event_t *ev)
+{
+    if (ev->request == XCB_MAPPING_POINTER)
+        return false;
+    xcb_refresh_keyboard_mapping(symbols_, ev);
+    compile();
+    return true;
+}
+
+std::vector<xcb_keycode_t> Keyboard::keycodes(xcb_keysym_t keysym) const
+{
+    std::vector<xcb_keycode_t> result;
+    xcb_keycode_t *keycodes = xcb_key_symbols_get_keycode(symbols_, keysym);
+    if (keycodes == nullptr)
+        return result;
+    for (const xcb_keycode_t *keycode = keycodes; *keycode != XCB_NO_SYMBOL; ++keycode)
+        result.push_back(*keycode);
+    free(keycodes);
+    return result;
+}
+
+void Keyboard::compile()
+{
+    // 1. Find the modifiers NumLock and ScrollLock are mapped to, CapsLock is
+    // always LockMask.
+    locks_ = XCB_MOD_MASK_LOCK;
+    modifiers_of_.fill(0);
+    xcb_get_modifier_mapping_reply_t *mapping = xcb_get_modifier_mapping_reply(
+        conn_, xcb_get_modifier_mapping(conn_), nullptr);
+    if (mapping) {
+        std::vector<xcb_keycode_t> lock_keys = keycodes(KEYSYM_NUM_LOCK);
+        const std::vector<xcb_keycode_t> scroll_lock = keycodes(KEYSYM_SCROLL_LOCK);
+        lock_keys.insert(lock_keys.end(), scroll_lock.begin(), scroll_lock.end());
+        const xcb_keycode_t *modmap = xcb_get_modifier_mapping_keycodes(mapping);
+        const uint8_t per_modifier = mapping->keycodes_per_modifier;
+        for (int modifier = 0; modifier < 8; ++modifier) {
+            for (int i = 0; i < per_modifier; ++i) {
+                const xcb_keycode_t keycode = modmap[modifier * per_modifier + i];
+                if (keycode == XCB_NO_SYMBOL)
+                    continue;
+                modifiers_of_[keycode] |= 1 << modifier;
+                if (std::find(lock_keys.begin(), lock_keys.end(), keycode) != lock_keys.end())
+                    locks_ |= 1 << modifier;
+            }
+        }
+        free(mapping);
+    }
+    mask_ = 0xff & ~locks_;
+
+    // 2. Every subset of the lock modifiers.
+    lock_combinations_.clear();
+    for (uint16_t subset = 0;; subset = (subset - locks_) & locks_) {
+        lock_combinations_.push_back(subset);
+        if (subset == locks_)
+            break;
+    }
+
+    // 3. The table, keyed by every keycode producing the bound keysym.
+    table_.fill(Command{Action::NONE, 0});
+    grabs_.clear();
+    for (const KeyBinding &binding : bindings_) {
+        const uint16_t modifiers = binding.modifiers & mask_;
+        for (const xcb_keycode_t keycode : keycodes(binding.keysym)) {
+            table_[keycode << 8 | modifiers] = Command{binding.action, binding.argument};
+            grabs_.emplace_back(keycode, modifiers);
+        }
+    }
+    WM_LOG(INFO, "Compiled {} key bindings into {} grabs, lock modifiers {x}",
+           bindings_.size(), grabs_.size(), locks_);
+}
+
+} // namespace x11
@@ -0,0 +1,134 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace x11
+{
+
+namespace
+{
+
+const char *const LAYOUT_NAMES[] = {"floating", "master-stack", "grid", "monocle"};
+constexpr size_t LAYOUT_COUNT = sizeof(LAYOUT_NAMES) / sizeof(LAYOUT_NAMES[0]);
+
+// Fit a frame and its client into a cell of the layout, border included.
+// Frames never get smaller than the decoration plus one pixel of client.
+Placement place(const LayoutParams &params, int x, int y, int width, int height)
+{
+    const int gap = params.gap;
+    const int frame_width = std::max(width - gap - 2 * params.border, 1);
+    const int frame_height = std::max(height - gap - 2 * params.border, params.title + 1);
+    Placement placement;
+    placement.frame = Rect(static_cast<int16_t>(x + gap), static_cast<int16_t>(y + gap),
+                           static_cast<uint16_t>(frame_width),
+                           static_cast<uint16_t>(frame_height));
+    placement.client = Rect(0, static_cast<int16_t>(params.title),
+                            static_cast<uint16_t>(frame_width),
+                            static_cast<uint16_t>(frame_height - params.title));
+    return placement;
+}
+
+// Split [start, start + length) into count slices, the i-th of them.
+// The slices differ by one pixel at most and cover the range exactly.
+void slice(int start, int length, size_t count, size_t i, int &from, int &size)
+{
+    from = start + static_cast<int>(length * i / count);
+    size = start + static_cast<int>(length * (i + 1) / count) - from;
+}
+
+// Cells are computed without the gap on the right and bottom edges of the
+// area, place() takes it off the top left of every cell instead.
+void masterStack(const LayoutParams &params, size_t count, std::vector<Placement> &placements)
+{
+    const Rect &area = params.area;
+    const int width = area.width - params.gap;
+    const int height = area.height - params.gap;
+    const size_t masters = std::min<size_t>(std::max(params.masters, 1u), count);
+    const size_t stacked = count - masters;
+    const int master_width = stacked == 0 ? width : static_cast<int>(width * params.master_ratio);
+    int y, h;
+    for (size_t i = 0; i < masters; ++i) {
+        slice(area.y, height, masters, i, y, h);
+        placements[i] = place(params, area.x, y, master_width, h);
+    }
+    for (size_t i = 0; i < stacked; ++i) {
+        slice(area.y, height, stacked, i, y, h);
+        placements[masters + i] =
+            place(params, area.x + master_width, y, width - master_width, h);
+    }
+}
+
+void grid(const LayoutParams &params, size_t count, std::vector<Placement> &placements)
+{
+    const Rect &area = params.area;
+    const int width = area.width - params.gap;
+    const int height = area.height - params.gap;
+    const size_t columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+    const size_t rows = (count + columns - 1) / columns;
+    int x, y, w, h;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t row = i / columns;
+        // The last row may be short, its windows get wider.
+        const size_t in_row = row + 1 < rows ? columns : count - row * columns;
+        slice(area.y, height, rows, row, y, h);
+        slice(area.x, width, in_row, i % columns, x, w);
+        placements[i] = place(params, x, y, w, h);
+    }
+}
+
+void monocle(const LayoutParams &params, size_t count, std::vector<Placement> &placements)
+{
+    const Rect &area = params.area;
+    const Placement full = place(params, area.x, area.y, area.width - params.gap,
+                                 area.height - params.gap);
+    std::fill(placements.begin(), placements.begin() + count, full);
+}
+
+} // namespace
+
+const char *layout_name(Layout layout)
+{
+    const size_t index = static_cast<size_t>(layout);
+    return index < LAYOUT_COUNT ? LAYOUT_NAMES[index] : "unknown";
+}
+
+Layout next_layout(Layout layout)
+{
+    return static_cast<Layout>((static_cast<size_t>(layout) + 1) % LAYOUT_COUNT);
+}
+
+bool parse_layout(const char *name, Layout &layout)
+{
+    for (size_t i = 0; i < LAYOUT_COUNT; ++i) {
+        if (strcmp(name, LAYOUT_NAMES[i]) == 0) {
+            layout = static_cast<Layout>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void arrange(Layout layout, const LayoutParams &params, size_t count,
+             std::vector<Placement> &placements)
+{
+    placements.resize(count);
+    if (count == 0)
+        return;
+    switch (layout) {
+    case Layout::MASTER_STACK:
+        masterStack(params, count, placements);
+        break;
+    case Layout::GRID:
+        grid(params, count, placements);
+        break;
+    case Layout::MONOCLE:
+        monocle(params, count, placements);
+        break;
+    case Layout::FLOATING:
+        break;
+    }
+}
+
+} // namespace x11
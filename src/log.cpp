@@ -0,0 +1,125 @@
+#include "log.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+
+namespace x11
+{
+
+constexpr size_t LogRecord::MAX_ARGS;
+constexpr size_t LogRecord::TEXT_SIZE;
+constexpr size_t Logger::CAPACITY;
+
+Logger &Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::~Logger()
+{
+    stop();
+}
+
+void Logger::start()
+{
+    if (running_.exchange(true))
+        return;
+    thread_ = std::thread(&Logger::run, this);
+}
+
+void Logger::stop()
+{
+    if (!running_.exchange(false))
+        return;
+    thread_.join();
+}
+
+void Logger::run()
+{
+    std::string out;
+    uint64_t dropped = 0;
+    for (;;) {
+        // Read the flag first, so that the records of a stop() are all drained.
+        const bool running = running_.load(std::memory_order_acquire);
+        const size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail)
+            format(ring_[tail & (CAPACITY - 1)], out);
+        tail_.store(tail, std::memory_order_release);
+
+        const uint64_t now_dropped = dropped_.load(std::memory_order_relaxed);
+        if (now_dropped != dropped) {
+            char line[64];
+            snprintf(line, sizeof(line), "W log ring full, %" PRIu64 " records dropped\n",
+                     now_dropped - dropped);
+            out += line;
+            dropped = now_dropped;
+        }
+        if (!out.empty()) {
+            fwrite(out.data(), 1, out.size(), stderr);
+            fflush(stderr);
+            out.clear();
+        } else if (!running) {
+            return;
+        } else {
+            // Nothing to do. Polling keeps the producer free of any wake-up call.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+}
+
+void Logger::format(const LogRecord &record, std::string &out)
+{
+    static const char levels[] = {'D', 'I', 'W', 'E'};
+    const auto since_epoch = record.time.time_since_epoch();
+    const time_t seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+    const long micros = std::chrono::duration_cast<std::chrono::microseconds>(since_epoch).count() % 1000000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%c %02d:%02d:%02d.%06ld ",
+             levels[static_cast<size_t>(record.level)], local.tm_hour, local.tm_min,
+             local.tm_sec, micros);
+    out += buffer;
+
+    size_t arg = 0;
+    for (const char *p = record.format; *p; ++p) {
+        const bool hex = p[0] == '{' && p[1] == 'x' && p[2] == '}';
+        if (!(p[0] == '{' && p[1] == '}') && !hex) {
+            out += *p;
+            continue;
+        }
+        p += hex ? 2 : 1;
+        if (arg >= record.arg_count) {
+            out += "{?}";
+            continue;
+        }
+        const uint64_t value = record.args[arg];
+        switch (record.types[arg++]) {
+        case LogRecord::SIGNED:
+            if (hex)
+                snprintf(buffer, sizeof(buffer), "0x%" PRIx64, value);
+            else
+                snprintf(buffer, sizeof(buffer), "%" PRId64, static_cast<int64_t>(value));
+            out += buffer;
+            break;
+        case LogRecord::UNSIGNED:
+            snprintf(buffer, sizeof(buffer), hex ? "0x%" PRIx64 : "%" PRIu64, value);
+            out += buffer;
+            break;
+        case LogRecord::STATIC_STRING: {
+            const char *text = reinterpret_cast<const char *>(static_cast<uintptr_t>(value));
+            out += text ? text : "(null)";
+            break;
+        }
+        case LogRecord::TEXT:
+            out.append(record.text + (value >> 8), value & 0xff);
+            break;
+        }
+    }
+    out += '\n';
+}
+
+} // namespace x11
@@ -0,0 +1,299 @@
+#include "metrics.h"
+#include "aux.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+namespace x11
+{
+
+constexpr unsigned Histogram::SUB_BUCKET_BITS;
+constexpr unsigned Histogram::SUB_BUCKETS;
+constexpr unsigned Histogram::MAX_EXPONENT;
+constexpr size_t Histogram::BUCKETS;
+
+size_t Histogram::bucketOf(uint64_t ns) noexcept
+{
+    // The first two powers of two are exact.
+    if (ns < 2 * SUB_BUCKETS)
+        return ns;
+    const unsigned exponent = 63 - __builtin_clzll(ns);
+    if (exponent > MAX_EXPONENT)
+        return BUCKETS - 1;
+    // The top SUB_BUCKET_BITS + 1 bits of the value pick the bucket.
+    const unsigned shift = exponent - SUB_BUCKET_BITS;
+    return shift * SUB_BUCKETS + (ns >> shift);
+}
+
+uint64_t Histogram::upperBoundOf(size_t bucket) noexcept
+{
+    if (bucket < 2 * SUB_BUCKETS)
+        return bucket;
+    const unsigned shift = bucket / SUB_BUCKETS - 1;
+    const uint64_t mantissa = bucket % SUB_BUCKETS + SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t ns) noexcept
+{
+    ++buckets_[bucketOf(ns)];
+    ++count_;
+    sum_ += ns;
+    if (ns > max_)
+        max_ = ns;
+}
+
+double Histogram::mean() const noexcept
+{
+    return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+}
+
+uint64_t Histogram::quantile(double quantile) const noexcept
+{
+    if (count_ == 0)
+        return 0;
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile * count_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank)
+            return std::min(upperBoundOf(i), max_);
+    }
+    return max_;
+}
+
+Metrics::Metrics()
+    : start_(std::chrono::steady_clock::now())
+    , current_(&loop_)
+{
+}
+
+Metrics::EventStats &Metrics::stats(uint8_t response_type)
+{
+    std::unique_ptr<EventStats> &slot = events_[response_type & 0x7f];
+    if (!slot)
+        slot.reset(new EventStats);
+    return *slot;
+}
+
+void Metrics::start(EventStats &stats, size_t queue_depth) noexcept
+{
+    current_ = &stats;
+    ++stats.count;
+    stats.queue_depth_sum += queue_depth;
+    if (queue_depth > stats.queue_depth_max)
+        stats.queue_depth_max = queue_depth;
+    handler_start_ = std::chrono::steady_clock::now();
+}
+
+void Metrics::begin(uint8_t response_type, size_t queue_depth) noexcept
+{
+    start(stats(response_type), queue_depth);
+}
+
+void Metrics::beginTick(size_t windows) noexcept
+{
+    start(tick_, windows);
+}
+
+void Metrics::batch(size_t events, size_t coalesced) noexcept
+{
+    batch_sizes_.record(events);
+    coalesced_ += coalesced;
+}
+
+double Metrics::flushesPerSecond() const noexcept
+{
+    uint64_t flushes = tick_.flushes + loop_.flushes;
+    for (const std::unique_ptr<EventStats> &stats : events_) {
+        if (stats)
+            flushes += stats->flushes;
+    }
+    const double seconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - start_)
+                               .count()
+                           / 1e6;
+    return seconds > 0 ? flushes / seconds : 0.0;
+}
+
+void Metrics::end() noexcept
+{
+    const auto elapsed = std::chrono::steady_clock::now() - handler_start_;
+    current_->handler_time.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    current_ = &loop_;
+}
+
+namespace
+{
+
+void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void append(std::string &out, const char *format, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0)
+        out.append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+}
+
+double us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+double depthMean(const Metrics::EventStats &stats)
+{
+    return stats.count ? static_cast<double>(stats.queue_depth_sum) / stats.count : 0.0;
+}
+
+} // namespace
+
+void Metrics::appendText(std::string &out, const char *name, const EventStats &stats)
+{
+    const Histogram &time = stats.handler_time;
+    append(out, "%-18s %9" PRIu64 " %9.1f %9.1f %9.1f %9" PRIu64 " %8" PRIu64
+                " %8" PRIu64 " %8.2f %6" PRIu64 "\n",
+           name, stats.count, us(time.quantile(0.5)), us(time.quantile(0.99)),
+           us(time.max()), stats.round_trips, stats.requests, stats.flushes,
+           depthMean(stats), stats.queue_depth_max);
+}
+
+void Metrics::appendJson(std::string &out, const char *name, const EventStats &stats)
+{
+    const Histogram &time = stats.handler_time;
+    append(out, "\"%s\":{\"count\":%" PRIu64 ",\"round_trips\":%" PRIu64
+                ",\"requests\":%" PRIu64 ",\"flushes\":%" PRIu64
+                ",\"queue_depth_max\":%" PRIu64 ",\"queue_depth_mean\":%.3f",
+           name, stats.count, stats.round_trips, stats.requests, stats.flushes,
+           stats.queue_depth_max, depthMean(stats));
+    append(out, ",\"handler_us\":{\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+                "\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}}",
+           time.mean() / 1000.0, us(time.quantile(0.5)), us(time.quantile(0.9)),
+           us(time.quantile(0.99)), us(time.quantile(0.999)), us(time.max()));
+}
+
+std::string Metrics::toText() const
+{
+    std::string out;
+    append(out, "%-18s %9s %9s %9s %9s %9s %8s %8s %8s %6s\n", "event", "count",
+           "p50(us)", "p99(us)", "max(us)", "roundtrip", "requests", "flushes",
+           "depth", "maxdep");
+    for (size_t type = 0; type < events_.size(); ++type) {
+        if (events_[type])
+            appendText(out, event_name(type), *events_[type]);
+    }
+    appendText(out, "(motion tick)", tick_);
+    appendText(out, "(loop)", loop_);
+    append(out, "batches %" PRIu64 ", events per batch p50 %" PRIu64 " p99 %" PRIu64
+                " max %" PRIu64 " mean %.2f, coalesced %" PRIu64 ", flushes/s %.2f\n",
+           batch_sizes_.count(), batch_sizes_.quantile(0.5), batch_sizes_.quantile(0.99),
+           batch_sizes_.max(), batch_sizes_.mean(), coalesced_, flushesPerSecond());
+    return out;
+}
+
+std::string Metrics::toJson() const
+{
+    const auto uptime = std::chrono::steady_clock::now() - start_;
+    std::string out;
+    append(out, "{\"uptime_us\":%lld,",
+           static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(uptime).count()));
+    appendJson(out, "loop", loop_);
+    out += ',';
+    appendJson(out, "motion_tick", tick_);
+    append(out, ",\"batches\":{\"count\":%" PRIu64 ",\"coalesced\":%" PRIu64
+                ",\"events_mean\":%.3f,\"events_p50\":%" PRIu64 ",\"events_p99\":%" PRIu64
+                ",\"events_max\":%" PRIu64 "},\"flushes_per_second\":%.3f",
+           batch_sizes_.count(), coalesced_, batch_sizes_.mean(), batch_sizes_.quantile(0.5),
+           batch_sizes_.quantile(0.99), batch_sizes_.max(), flushesPerSecond());
+    out += ",\"events\":{";
+    bool first = true;
+    for (size_t type = 0; type < events_.size(); ++type) {
+        if (!events_[type])
+            continue;
+        // Extension events share a name, key them by type instead.
+        char key[32];
+        if (type > XCB_MAPPING_NOTIFY)
+            snprintf(key, sizeof(key), "%s%zu", event_name(type), type);
+        else
+            snprintf(key, sizeof(key), "%s", event_name(type));
+        if (!first)
+            out += ',';
+        appendJson(out, key, *events_[type]);
+        first = false;
+    }
+    out += "}}\n";
+    return out;
+}
+
+MetricsSocket::MetricsSocket(const std::string &path)
+    : path_(path)
+    , fd_(-1)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        LOG(ERROR) << "Metrics socket path too long: " << path;
+        return;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        PLOG(ERROR) << "Metrics socket";
+        return;
+    }
+    // A stale socket of a previous run would make bind() fail.
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0
+        || listen(fd, 4) < 0) {
+        PLOG(ERROR) << "Metrics socket " << path;
+        close(fd);
+        return;
+    }
+    fd_ = fd;
+    LOG(INFO) << "Serving metrics on " << path;
+}
+
+MetricsSocket::~MetricsSocket()
+{
+    if (fd_ < 0)
+        return;
+    close(fd_);
+    unlink(path_.c_str());
+}
+
+void MetricsSocket::serve(const Metrics &metrics)
+{
+    int client;
+    while ((client = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+        // The event loop waits for this write, don't let a stuck reader hang it.
+        const timeval timeout = {0, 100000};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        const std::string json = metrics.toJson();
+        size_t written = 0;
+        while (written < json.size()) {
+            const ssize_t n = send(client, json.data() + written,
+                                   json.size() - written, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            written += n;
+        }
+        close(client);
+    }
+}
+
+} // namespace x11
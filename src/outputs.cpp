@@ -0,0 +1,251 @@
+#include "outputs.h"
+
+extern "C" {
+#include <xcb/randr.h>
+}
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+
+#include "log.h"
+
+namespace x11
+{
+
+namespace
+{
+
+// Less of a window on every output than this, in both directions, and the
+// window counts as lost.
+constexpr int MIN_VISIBLE = 32;
+
+int overlap(int a, int a_length, int b, int b_length)
+{
+    return std::max(0, std::min(a + a_length, b + b_length) - std::max(a, b));
+}
+
+// Keep [position, position + length) inside [start, start + size), or at its
+// start if it is too long.
+int16_t fit(int position, int length, int start, int size)
+{
+    return static_cast<int16_t>(std::max(start, std::min(position, start + size - length)));
+}
+
+} // namespace
+
+Outputs::Outputs(xcb_connection_t *c, xcb_screen_t *screen, Metrics &metrics)
+    : conn_(c)
+    , root_(screen->root)
+    , metrics_(metrics)
+    , root_rect_(0, 0, screen->width_in_pixels, screen->height_in_pixels)
+{
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn_, &xcb_randr_id);
+    if (extension && extension->present) {
+        metrics_.roundTrip();
+        xcb_randr_query_version_reply_t *version = xcb_randr_query_version_reply(
+            conn_, xcb_randr_query_version(conn_, 1, 5), nullptr);
+        if (version) {
+            first_event_ = extension->first_event;
+            monitors_ = version->major_version > 1
+                        || (version->major_version == 1 && version->minor_version >= 5);
+            free(version);
+            xcb_randr_select_input(conn_, root_,
+                                   XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE
+                                       | XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE
+                                       | XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+        }
+    }
+    refresh();
+    changed_ = false;
+}
+
+bool Outputs::handle(const xcb_generic_event_t *event)
+{
+    if (first_event_ == 0)
+        return false;
+    const uint8_t type = event->response_type & ~0x80;
+    if (type == first_event_ + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+        const auto *ev = reinterpret_cast<const xcb_randr_screen_change_notify_event_t *>(event);
+        WM_LOG(INFO, "Screen changed to {}x{}", ev->width, ev->height);
+        root_rect_ = Rect(0, 0, ev->width, ev->height);
+        stale_ = true;
+        return true;
+    }
+    if (type != first_event_ + XCB_RANDR_NOTIFY)
+        return false;
+    const auto *ev = reinterpret_cast<const xcb_randr_notify_event_t *>(event);
+    if (ev->subCode != XCB_RANDR_NOTIFY_CRTC_CHANGE || monitors_) {
+        // Monitors are made of outputs, only the server knows what became of them.
+        stale_ = true;
+        return true;
+    }
+    // A CRTC moved, was resized, switched on or off: that is the whole change.
+    const xcb_randr_crtc_change_t &change = ev->u.cc;
+    auto found = std::find_if(outputs_.begin(), outputs_.end(),
+                              [&change](const Output &output) { return output.id == change.crtc; });
+    if (change.mode == XCB_NONE) {
+        if (found != outputs_.end()) {
+            outputs_.erase(found);
+            changed_ = true;
+        }
+        // The last output went away, the table falls back to the root.
+        if (outputs_.empty())
+            stale_ = true;
+        return true;
+    }
+    const Rect rect(change.x, change.y, change.width, change.height);
+    if (found == outputs_.end()) {
+        // Whether it shows the primary output is only known from a query.
+        outputs_.push_back({change.crtc, rect, false});
+        stale_ = true;
+    } else if (found->rect != rect) {
+        found->rect = rect;
+    } else {
+        return true;
+    }
+    changed_ = true;
+    return true;
+}
+
+bool Outputs::update()
+{
+    if (stale_)
+        refresh();
+    const bool changed = changed_;
+    changed_ = false;
+    return changed;
+}
+
+void Outputs::refresh()
+{
+    const std::vector<Output> previous = std::move(outputs_);
+    outputs_.clear();
+    stale_ = false;
+    if (first_event_ != 0) {
+        if (monitors_)
+            refreshMonitors();
+        else
+            refreshCrtcs();
+    }
+    if (outputs_.empty())
+        outputs_.push_back({0, root_rect_, true});
+
+    const auto same = [](const Output &a, const Output &b) -> bool {
+        return a.id == b.id && a.rect == b.rect && a.primary == b.primary;
+    };
+    if (previous.size() != outputs_.size()
+        || !std::equal(previous.begin(), previous.end(), outputs_.begin(), same))
+        changed_ = true;
+    for (const Output &output : outputs_)
+        WM_LOG(INFO, "Output {}: {}x{} at ({}, {}){}", output.id, output.rect.width,
+               output.rect.height, output.rect.x, output.rect.y,
+               output.primary ? ", primary" : "");
+}
+
+void Outputs::refreshMonitors()
+{
+    metrics_.roundTrip();
+    xcb_randr_get_monitors_reply_t *reply =
+        xcb_randr_get_monitors_reply(conn_, xcb_randr_get_monitors(conn_, root_, 1), nullptr);
+    if (reply == nullptr)
+        return;
+    for (xcb_randr_monitor_info_iterator_t i = xcb_randr_get_monitors_monitors_iterator(reply);
+         i.rem; xcb_randr_monitor_info_next(&i)) {
+        const xcb_randr_monitor_info_t &monitor = *i.data;
+        if (monitor.width == 0 || monitor.height == 0)
+            continue;
+        outputs_.push_back({monitor.name, Rect(monitor.x, monitor.y, monitor.width, monitor.height),
+                            monitor.primary != 0});
+    }
+    free(reply);
+}
+
+void Outputs::refreshCrtcs()
+{
+    xcb_randr_get_output_primary_cookie_t primary_cookie =
+        xcb_randr_get_output_primary(conn_, root_);
+    metrics_.roundTrip();
+    xcb_randr_get_screen_resources_current_reply_t *resources =
+        xcb_randr_get_screen_resources_current_reply(
+            conn_, xcb_randr_get_screen_resources_current(conn_, root_), nullptr);
+    if (resources == nullptr) {
+        xcb_discard_reply(conn_, primary_cookie.sequence);
+        return;
+    }
+    const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(resources);
+    const int crtcs_length = xcb_randr_get_screen_resources_current_crtcs_length(resources);
+    std::vector<xcb_randr_get_crtc_info_cookie_t> cookies(crtcs_length);
+    for (int i = 0; i < crtcs_length; ++i)
+        cookies[i] = xcb_randr_get_crtc_info(conn_, crtcs[i], resources->config_timestamp);
+
+    // Answered together with the resources above.
+    xcb_randr_get_output_primary_reply_t *primary =
+        xcb_randr_get_output_primary_reply(conn_, primary_cookie, nullptr);
+    const xcb_randr_output_t primary_output = primary ? primary->output : XCB_NONE;
+    free(primary);
+    // One round trip for the info of all CRTCs.
+    if (crtcs_length != 0)
+        metrics_.roundTrip();
+    for (int i = 0; i < crtcs_length; ++i) {
+        xcb_randr_get_crtc_info_reply_t *info =
+            xcb_randr_get_crtc_info_reply(conn_, cookies[i], nullptr);
+        if (info == nullptr)
+            continue;
+        if (info->mode != XCB_NONE && info->width != 0 && info->height != 0) {
+            const xcb_randr_output_t *outputs = xcb_randr_get_crtc_info_outputs(info);
+            const xcb_randr_output_t *end = outputs + xcb_randr_get_crtc_info_outputs_length(info);
+            outputs_.push_back({crtcs[i], Rect(info->x, info->y, info->width, info->height),
+                                primary_output != XCB_NONE
+                                    && std::find(outputs, end, primary_output) != end});
+        }
+        free(info);
+    }
+    free(resources);
+}
+
+const Output &Outputs::primary() const noexcept
+{
+    for (const Output &output : outputs_) {
+        if (output.primary)
+            return output;
+    }
+    return outputs_.front();
+}
+
+const Output *Outputs::at(int16_t x, int16_t y) const noexcept
+{
+    for (const Output &output : outputs_) {
+        const Rect &r = output.rect;
+        if (x >= r.x && x < r.x + r.width && y >= r.y && y < r.y + r.height)
+            return &output;
+    }
+    return nullptr;
+}
+
+Rect Outputs::clamp(const Rect &outer) const noexcept
+{
+    const int min_width = std::min<int>(MIN_VISIBLE, outer.width);
+    const int min_height = std::min<int>(MIN_VISIBLE, outer.height);
+    const Output *nearest = nullptr;
+    long nearest_distance = std::numeric_limits<long>::max();
+    const long center_x = outer.x + outer.width / 2;
+    const long center_y = outer.y + outer.height / 2;
+    for (const Output &output : outputs_) {
+        const Rect &r = output.rect;
+        if (overlap(outer.x, outer.width, r.x, r.width) >= min_width
+            && overlap(outer.y, outer.height, r.y, r.height) >= min_height)
+            return outer;
+        const long dx = center_x - (r.x + r.width / 2);
+        const long dy = center_y - (r.y + r.height / 2);
+        if (dx * dx + dy * dy < nearest_distance) {
+            nearest_distance = dx * dx + dy * dy;
+            nearest = &output;
+        }
+    }
+    const Rect &r = nearest->rect;
+    return Rect(fit(outer.x, outer.width, r.x, r.width), fit(outer.y, outer.height, r.y, r.height),
+                outer.width, outer.height);
+}
+
+} // namespace x11
@@ -0,0 +1,25 @@
+#include "request.h"
+
+namespace x11
+{
+
+constexpr size_t RequestTracker::CAPACITY;
+
+void RequestTracker::track(xcb_void_cookie_t cookie, const char *message,
+                           const char *origin) noexcept
+{
+    Request &slot = ring_[cookie.sequence & (CAPACITY - 1)];
+    slot.sequence = cookie.sequence;
+    slot.message = message;
+    slot.origin = origin;
+}
+
+const RequestTracker::Request *RequestTracker::find(uint32_t sequence) const noexcept
+{
+    const Request &slot = ring_[sequence & (CAPACITY - 1)];
+    if (slot.message == nullptr || slot.sequence != sequence)
+        return nullptr;
+    return &slot;
+}
+
+} // namespace x11
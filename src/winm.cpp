@@ -2,18 +2,26 @@
 
 #include <xcb/xcb_aux.h>
 
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <iterator>
+#include <unordered_set>
+#include <vector>
 
 #include "aux.h"
+#include "log.h"
 #include "utils.hpp"
 
 extern "C" {
 #include <X11/Xutil.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_icccm.h>
-#include <xcb/xcb_keysyms.h>
 #include <xcb/xproto.h>
 }
 
@@ -24,12 +32,22 @@ using namespace utils;
 namespace x11
 {
 
+namespace
+{
+
+// A client slower than this to answer _NET_WM_SYNC_REQUEST is sent the next
+// size anyway, so that a hung client can still be resized.
+constexpr std::chrono::milliseconds SYNC_TIMEOUT(200);
+
+} // namespace
+
 std::atomic<bool> WindowManager::wm_detected_;
+volatile sig_atomic_t WindowManager::dump_metrics_ = 0;
 std::mutex WindowManager::wm_mutex_;
 WindowManager *WindowManager::instance_ = nullptr;
 
 std::unique_ptr<WindowManager> WindowManager::getInstance(
-    const std::string &display_name)
+    const std::string &display_name, const Config &config)
 {
     if (instance_ == nullptr) {
         std::lock_guard<std::mutex> guard(wm_mutex_);
@@ -44,212 +62,663 @@ std::unique_ptr<WindowManager> WindowManager::getInstance(
             // xcb_screen_t *s = xcb_setup_roots_iterator(xcb_get_setup(c)).data;
             xcb_screen_t *s = xcb_aux_get_screen(
                 c, NULL); // we can just use xcb auxiliary function to do above stuff
-            instance_ = new WindowManager(c, s);
+            instance_ = new WindowManager(c, s, config);
         }
     }
     return std::unique_ptr<WindowManager>(instance_);
 }
 
-WindowManager::WindowManager(xcb_connection_t *c, xcb_screen_t *s)
-    : conn(c)
+WindowManager::WindowManager(xcb_connection_t *c, xcb_screen_t *s,
+                             const Config &config)
+    : layout_(config.layout)
+    , config_(config)
+    , conn(c)
     , screen(s)
     , root(s->root)
-    ,
-    /*设置WM_PROTOCOLS协议族，并设置支持其中的WM_DELETE_WINDOW协议*/
-    WM_PROTOCOLS([this] {
-        auto res = xcb_intern_atom_reply(
-            conn,
-            xcb_intern_atom(conn, 0, strlen("WM_PROTOCOLS"),
-                            "WM_PROTOCOLS"), /*不存在就创建*/
-            NULL);
-        auto ret = res->atom;
-        free(res);
-        return ret;
-    }())
-    , WM_DELETE_WINDOW([this] {
-        auto res = xcb_intern_atom_reply(
-            conn,
-            xcb_intern_atom(conn, 0,
-                            strlen("WM_DELETE_WINDOW"), /*不存在就创建*/
-                            "WM_DELETE_WINDOW"),
-            NULL);
-        auto ret = res->atom;
-        free(res);
-        return ret;
-    }())
+    , dispatching_("startup")
 {
+    focus_order_.resize(config_.desktops);
+    atoms_.intern(conn);
+    decorations_.reset(new DecorationCache(conn, screen, "7x13"));
+    decorations_->font(); // Open and measure the font before any expose.
+    cursors_.reset(new CursorTable(conn));
+    // Drawing the outline twice erases it, whatever is below.
+    outline_gc_ = xcb_generate_id(conn);
+    const uint32_t outline_values[] = {XCB_GX_XOR, screen->white_pixel ^ screen->black_pixel,
+                                       XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS};
+    xcb_create_gc(conn, outline_gc_, root,
+                  XCB_GC_FUNCTION | XCB_GC_FOREGROUND | XCB_GC_SUBWINDOW_MODE, outline_values);
+    keyboard_.reset(new Keyboard(conn, default_bindings()));
+    outputs_.reset(new Outputs(conn, screen, metrics_));
+    // The SYNC extension must be initialized before its first request.
+    const xcb_query_extension_reply_t *sync = xcb_get_extension_data(conn, &xcb_sync_id);
+    if (sync && sync->present) {
+        metrics_.roundTrip();
+        xcb_sync_initialize_reply_t *version = xcb_sync_initialize_reply(
+            conn, xcb_sync_initialize(conn, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION),
+            nullptr);
+        if (version) {
+            sync_event_ = sync->first_event;
+            free(version);
+        }
+    }
 }
 
 WindowManager::~WindowManager()
 {
+    outputs_.reset();
+    keyboard_.reset();
+    xcb_free_gc(conn, outline_gc_);
+    cursors_.reset();
+    decorations_.reset();
     xcb_disconnect(conn);
 }
 
 void WindowManager::run()
 {
     wm_mutex_.lock();
-    // Register SubstructureRedirection on Root Window
-    errorHandler(xcb_change_window_attributes_checked(
-                     conn, root, XCB_CW_EVENT_MASK,
-                     (const uint32_t[]){XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY}),
-                 "WM register substructure redirection on root window");
-    xcb_flush(conn); // Flush to X Server
+    // Register SubstructureRedirection on Root Window.
+    // This is the only request we must wait for: it fails with BadAccess when
+    // another window manager is running.
+    if (auto error = xcb_request_check(
+            conn, xcb_change_window_attributes_checked(
+                      conn, root, XCB_CW_EVENT_MASK,
+                      (const uint32_t[]){XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY}))) {
+        free(error);
+        wm_detected_.store(true);
+    }
     if (wm_detected_.load()) {
+        wm_mutex_.unlock();
         LOG(ERROR) << "Detected another window manager on connection";
         return;
     }
     wm_mutex_.unlock();
 
-    errorHandler(xcb_grab_server_checked(conn), "grab X Server");
-
-    xcb_generic_error_t *error = nullptr;
-    xcb_query_tree_reply_t *result_tree =
-        xcb_query_tree_reply(conn, xcb_query_tree(conn, root), &error);
-    errorHandler(error, "query for window tree");
-
-    CHECK_EQ(result_tree->root, root);
-    LOG(WARNING) << "root children nums : " << result_tree->children_len;
-    LOG(INFO) << "root : " << root;
-    xcb_window_t *children = xcb_query_tree_children(result_tree);
-    for (uint16_t i = 0; i < result_tree->children_len; ++i) {
-        LOG(INFO) << "child " << i << " : " << children[i];
-        addFrame(children[i], true);
-    }
-    // free(children); // 不需要释放这个数组
-    free(result_tree);
+    // SIGUSR1 dumps the metrics. No SA_RESTART, so that it wakes up poll().
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = [](int) { dump_metrics_ = 1; };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+    if (!config_.metrics_socket.empty())
+        metrics_socket_.reset(new MetricsSocket(config_.metrics_socket));
 
-    errorHandler(xcb_ungrab_server_checked(conn), "ungrab X Server");
+    initEwmh();
+    grabBindings();
+    adoptWindows();
 
-    xcb_generic_event_t *event;
-    while ((event = xcb_wait_for_event(conn))) {
-        switch (event->response_type & ~0x80) {
-        case XCB_CLIENT_MESSAGE: {
-            onClientMessage((xcb_client_message_event_t *)event);
-            break;
-        }
-        case XCB_CREATE_NOTIFY: {
-            onCreateNotify((xcb_create_notify_event_t *)event);
-            break;
+    const int fd = xcb_get_file_descriptor(conn);
+    std::vector<xcb_generic_event_t *> batch;
+    while (!xcb_connection_has_error(conn)) {
+        // 1. Take everything that can be read right now. Only one read from
+        // the socket, so that a flood of events can't starve the motion tick.
+        xcb_generic_event_t *event = xcb_poll_for_event(conn);
+        while (event) {
+            batch.push_back(event);
+            event = xcb_poll_for_queued_event(conn);
         }
-        case XCB_DESTROY_NOTIFY: {
-            onDestroyNotify((xcb_destroy_notify_event_t *)event);
-            break;
+        if (!batch.empty()) {
+            const size_t read = batch.size();
+            metrics_.batch(read, coalesce(batch));
         }
-        case XCB_REPARENT_NOTIFY: {
-            onReparentNotify((xcb_reparent_notify_event_t *)event);
-            break;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            dispatch(batch[i], batch.size() - i - 1);
+            free(batch[i]);
         }
-        case XCB_MAP_NOTIFY: {
-            onMapNotify((xcb_map_notify_event_t *)event);
-            break;
+        batch.clear();
+        readPendingProperties();
+        // 2. Apply the coalesced motion once per frame, and send everything
+        // the batch produced with one flush. Handlers never flush, and the
+        // layout is computed once for all the windows the batch mapped.
+        if (outputs_->update())
+            placeOnOutputs();
+        if (relayout_)
+            relayout();
+        publishEwmh();
+        int timeout = applyMotions(false);
+        const int resize_timeout = applyResize(false);
+        if (resize_timeout >= 0 && (timeout < 0 || resize_timeout < timeout))
+            timeout = resize_timeout;
+        sendConfigureNotifies();
+        flush();
+        if (dump_metrics_)
+            dumpMetrics();
+        // 3. Sleep until the server sends something or the next frame is due.
+        // Flushing may have read events into the queue, don't sleep on those.
+        if ((event = xcb_poll_for_queued_event(conn))) {
+            batch.push_back(event);
+            continue;
         }
-        case XCB_UNMAP_NOTIFY: {
-            onUnmapNotify((xcb_unmap_notify_event_t *)event);
+        struct pollfd pfds[] = {{fd, POLLIN, 0}, {-1, POLLIN, 0}};
+        if (metrics_socket_)
+            pfds[1].fd = metrics_socket_->fd();
+        if (poll(pfds, 2, timeout) < 0 && errno != EINTR) {
+            PLOG(ERROR) << "poll on X connection";
             break;
         }
-        case XCB_CONFIGURE_NOTIFY: {
-            onConfigureNotify((xcb_configure_notify_event_t *)event);
+        if (pfds[1].revents & POLLIN)
+            metrics_socket_->serve(metrics_);
+    }
+    LOG(ERROR) << "X connection closed : " << xcb_connection_has_error(conn);
+}
+
+void WindowManager::dispatch(xcb_generic_event_t *event, size_t queue_depth)
+{
+    dispatching_ = event_name(event->response_type);
+    metrics_.begin(event->response_type, queue_depth);
+    switch (event->response_type & ~0x80) {
+    case 0: {
+        onError((xcb_generic_error_t *)event);
+        break;
+    }
+    case XCB_CLIENT_MESSAGE: {
+        onClientMessage((xcb_client_message_event_t *)event);
+        break;
+    }
+    case XCB_CREATE_NOTIFY: {
+        onCreateNotify((xcb_create_notify_event_t *)event);
+        break;
+    }
+    case XCB_DESTROY_NOTIFY: {
+        onDestroyNotify((xcb_destroy_notify_event_t *)event);
+        break;
+    }
+    case XCB_REPARENT_NOTIFY: {
+        onReparentNotify((xcb_reparent_notify_event_t *)event);
+        break;
+    }
+    case XCB_MAP_NOTIFY: {
+        onMapNotify((xcb_map_notify_event_t *)event);
+        break;
+    }
+    case XCB_UNMAP_NOTIFY: {
+        onUnmapNotify((xcb_unmap_notify_event_t *)event);
+        break;
+    }
+    case XCB_CONFIGURE_NOTIFY: {
+        onConfigureNotify((xcb_configure_notify_event_t *)event);
+        break;
+    }
+    case XCB_EXPOSE: {
+        onExpose((xcb_expose_event_t *)event);
+        break;
+    }
+    case XCB_PROPERTY_NOTIFY: {
+        onPropertyNotify((xcb_property_notify_event_t *)event);
+        break;
+    }
+    case XCB_MAP_REQUEST: {
+        onMapRequest((xcb_map_request_event_t *)event);
+        break;
+    }
+    case XCB_CONFIGURE_REQUEST: {
+        onConfigureRequest((xcb_configure_request_event_t *)event);
+        break;
+    }
+    case XCB_ENTER_NOTIFY: {
+        onEnterNotify((xcb_enter_notify_event_t *)event);
+        break;
+    }
+    case XCB_LEAVE_NOTIFY: {
+        onLeaveNotify((xcb_leave_notify_event_t *)event);
+        break;
+    }
+    case XCB_FOCUS_IN: {
+        onFocusIn((xcb_focus_in_event_t *)event);
+        break;
+    }
+    case XCB_FOCUS_OUT: {
+        onFocusOut((xcb_focus_out_event_t *)event);
+        break;
+    }
+    case XCB_BUTTON_PRESS: {
+        onButtonPress((xcb_button_press_event_t *)event);
+        break;
+    }
+    case XCB_BUTTON_RELEASE: {
+        onButtonRelease((xcb_button_release_event_t *)event);
+        break;
+    }
+    case XCB_KEY_PRESS: {
+        onKeyPress((xcb_key_press_event_t *)event);
+        break;
+    }
+    case XCB_KEY_RELEASE: {
+        onKeyRelease((xcb_key_release_event_t *)event);
+        break;
+    }
+    case XCB_MAPPING_NOTIFY: {
+        onMappingNotify((xcb_mapping_notify_event_t *)event);
+        break;
+    }
+    case XCB_MOTION_NOTIFY: {
+        // Only the newest motion of each window is applied, on the next frame.
+        const xcb_motion_notify_event_t *motion = (xcb_motion_notify_event_t *)event;
+        motions_[motion->event] = *motion;
+        break;
+    }
+    default:
+        // Extension events have no fixed type.
+        if (sync_event_ != 0 && event->response_type == sync_event_ + XCB_SYNC_ALARM_NOTIFY)
+            onSyncAlarm((xcb_sync_alarm_notify_event_t *)event);
+        else if (!outputs_->handle(event))
+            WM_LOG(DEBUG, "Unknown event {}", event->response_type);
+        break;
+    }
+    metrics_.end();
+}
+
+size_t WindowManager::coalesce(std::vector<xcb_generic_event_t *> &batch)
+{
+    // Walk backwards, so that every event is compared with the later ones.
+    std::unordered_map<xcb_window_t, xcb_configure_request_event_t *> configures;
+    std::unordered_set<xcb_window_t> unmapped; // unmapped or destroyed later
+    std::unordered_set<xcb_window_t> destroyed;
+    size_t dropped = 0;
+    for (size_t i = batch.size(); i-- > 0;) {
+        xcb_generic_event_t *event = batch[i];
+        bool drop = false;
+        switch (event->response_type & ~0x80) {
+        case XCB_DESTROY_NOTIFY: {
+            const xcb_window_t w = ((xcb_destroy_notify_event_t *)event)->window;
+            destroyed.insert(w);
+            unmapped.insert(w);
             break;
         }
-        case XCB_EXPOSE: {
-            onExpose((xcb_expose_event_t *)event);
+        case XCB_UNMAP_NOTIFY: {
+            // A window closing is unmapped, then destroyed: only the
+            // DestroyNotify unframes it, without requests to the dead window.
+            const xcb_window_t w = ((xcb_unmap_notify_event_t *)event)->window;
+            drop = destroyed.count(w) != 0;
+            unmapped.insert(w);
             break;
         }
-        case XCB_MAP_REQUEST: {
-            onMapRequest((xcb_map_request_event_t *)event);
+        case XCB_MAP_REQUEST:
+            drop = unmapped.count(((xcb_map_request_event_t *)event)->window) != 0;
             break;
-        }
         case XCB_CONFIGURE_REQUEST: {
-            onConfigureRequest((xcb_configure_request_event_t *)event);
-            break;
-        }
-        case XCB_ENTER_NOTIFY: {
-            onEnterNotify((xcb_enter_notify_event_t *)event);
-            break;
-        }
-        case XCB_LEAVE_NOTIFY: {
-            onLeaveNotify((xcb_leave_notify_event_t *)event);
-            break;
-        }
-        case XCB_FOCUS_IN: {
-            onFocusIn((xcb_focus_in_event_t *)event);
-            break;
-        }
-        case XCB_FOCUS_OUT: {
-            onFocusOut((xcb_focus_out_event_t *)event);
-            break;
-        }
-        case XCB_BUTTON_PRESS: {
-            onButtonPress((xcb_button_press_event_t *)event);
-            break;
-        }
-        case XCB_BUTTON_RELEASE: {
-            onButtonRelease((xcb_button_release_event_t *)event);
+            xcb_configure_request_event_t *ev = (xcb_configure_request_event_t *)event;
+            if (destroyed.count(ev->window)) {
+                drop = true;
+                break;
+            }
+            auto later = configures.find(ev->window);
+            if (later == configures.end()) {
+                configures[ev->window] = ev;
+                break;
+            }
+            // Fill in what the later request leaves out.
+            xcb_configure_request_event_t *into = later->second;
+            // Sibling and stack mode make one restack: the earlier pair only
+            // counts if the later request doesn't restack at all.
+            const uint16_t stacking = XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE;
+            uint16_t missing = ev->value_mask & ~into->value_mask;
+            if (into->value_mask & stacking)
+                missing &= ~stacking;
+            if (missing & XCB_CONFIG_WINDOW_X)
+                into->x = ev->x;
+            if (missing & XCB_CONFIG_WINDOW_Y)
+                into->y = ev->y;
+            if (missing & XCB_CONFIG_WINDOW_WIDTH)
+                into->width = ev->width;
+            if (missing & XCB_CONFIG_WINDOW_HEIGHT)
+                into->height = ev->height;
+            if (missing & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+                into->border_width = ev->border_width;
+            if (missing & XCB_CONFIG_WINDOW_SIBLING)
+                into->sibling = ev->sibling;
+            if (missing & XCB_CONFIG_WINDOW_STACK_MODE)
+                into->stack_mode = ev->stack_mode;
+            into->value_mask |= missing;
+            drop = true;
             break;
         }
-        case XCB_KEY_PRESS: {
-            onKeyPress((xcb_key_press_event_t *)event);
+        default:
             break;
         }
-        case XCB_KEY_RELEASE: {
-            onKeyRelease((xcb_key_release_event_t *)event);
-            break;
+        if (drop) {
+            free(event);
+            batch[i] = nullptr;
+            ++dropped;
         }
-        case XCB_MOTION_NOTIFY: {
-            // Skip any already pending motion events, we only need the newest one.
-            while ((event = xcb_poll_for_queued_event(conn)))
-                if (event->response_type == XCB_MOTION_NOTIFY)
-                    free(event);
-            onMotionNotify((xcb_motion_notify_event_t *)event);
-            break;
+    }
+    if (dropped)
+        batch.erase(std::remove(batch.begin(), batch.end(), nullptr), batch.end());
+    return dropped;
+}
+
+void WindowManager::flush()
+{
+    metrics_.flush();
+    xcb_flush(conn);
+}
+
+void WindowManager::dumpMetrics()
+{
+    dump_metrics_ = 0;
+    LOG(WARNING) << "Event loop metrics:\n" << metrics_.toText();
+}
+
+int WindowManager::applyMotions(bool force)
+{
+    if (motions_.empty())
+        return -1;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force && config_.motion_rate != 0 && now < next_motion_) {
+        // Round up, so that we don't wake up just before the frame is due.
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   next_motion_ - now + std::chrono::microseconds(999))
+            .count();
+    }
+    const char *dispatching = dispatching_;
+    dispatching_ = "MotionNotify";
+    metrics_.beginTick(motions_.size());
+    for (auto &motion : motions_)
+        onMotionNotify(&motion.second);
+    metrics_.end();
+    motions_.clear();
+    dispatching_ = dispatching;
+    if (config_.motion_rate != 0)
+        next_motion_ = now + std::chrono::microseconds(1000000 / config_.motion_rate);
+    return -1;
+}
+
+void WindowManager::relayout()
+{
+    relayout_ = false;
+    if (layout_ == Layout::FLOATING)
+        return;
+    LayoutParams params;
+    params.area = outputs_->primary().rect;
+    params.border = FRAME_BORDER_WIDTH;
+    params.title = TITLE_HEIGHT;
+    // Windows of the other desktops keep their place until they are shown.
+    scratch_list_.clear();
+    for (const xcb_window_t w : tile_order_) {
+        const Client &client = clients_.at(w);
+        if (client.desktop == current_desktop_ && !client.floating)
+            scratch_list_.push_back(w);
+    }
+    arrange(layout_, params, scratch_list_.size(), placements_);
+
+    // Only what differs from the local geometry goes to the server.
+    size_t changed = 0;
+    for (size_t i = 0; i < scratch_list_.size(); ++i) {
+        Client &client = clients_.at(scratch_list_[i]);
+        const Placement &placement = placements_[i];
+        const Rect frame(client.frame_pos.x, client.frame_pos.y, client.frame_size.width,
+                         client.frame_size.height);
+        if (frame != placement.frame) {
+            const uint32_t values[] = {static_cast<uint32_t>(placement.frame.x),
+                                       static_cast<uint32_t>(placement.frame.y),
+                                       placement.frame.width, placement.frame.height};
+            errorHandler(xcb_configure_window(conn, client.frame,
+                                              XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
+                                                  | XCB_CONFIG_WINDOW_WIDTH
+                                                  | XCB_CONFIG_WINDOW_HEIGHT,
+                                              values),
+                         "tile frame");
+            client.frame_pos = Position<int16_t>(placement.frame.x, placement.frame.y);
+            client.frame_size = Size<uint16_t>(placement.frame.width, placement.frame.height);
+            queueConfigureNotify(client);
+            ++changed;
         }
-        default:
-            printf("Unknown event: %d\n", event->response_type);
-            break;
+        const Rect inner(client.pos.x, client.pos.y, client.size.width, client.size.height);
+        if (inner != placement.client) {
+            const uint32_t values[] = {static_cast<uint32_t>(placement.client.x),
+                                       static_cast<uint32_t>(placement.client.y),
+                                       placement.client.width, placement.client.height};
+            errorHandler(xcb_configure_window(conn, client.window,
+                                              XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
+                                                  | XCB_CONFIG_WINDOW_WIDTH
+                                                  | XCB_CONFIG_WINDOW_HEIGHT,
+                                              values),
+                         "tile window");
+            client.pos = Position<int16_t>(placement.client.x, placement.client.y);
+            client.size = Size<uint16_t>(placement.client.width, placement.client.height);
         }
-        free(event);
     }
+    WM_LOG(DEBUG, "Relayout of {} windows as {}, {} frames changed", scratch_list_.size(),
+           layout_name(layout_), changed);
 }
 
-void WindowManager::addFrame(xcb_window_t w, bool created_before)
+void WindowManager::placeOnOutputs()
 {
-    const unsigned int BORDER_WIDTH = 5;
-    LOG(WARNING) << "want to frame :" << w;
-    // Forbid multiple frame.
-    CHECK(!clients_.count(w));
+    // Tiled windows follow the new area of the layout instead.
+    relayout_ = true;
+    if (layout_ != Layout::FLOATING)
+        return;
+    size_t moved = 0;
+    for (auto &entry : clients_) {
+        Client &client = entry.second;
+        const Rect outer(client.frame_pos.x, client.frame_pos.y,
+                         client.frame_size.width + 2 * client.frame_border,
+                         client.frame_size.height + 2 * client.frame_border);
+        const Rect placed = outputs_->clamp(outer);
+        if (placed.x == outer.x && placed.y == outer.y)
+            continue;
+        const uint32_t values[] = {static_cast<uint32_t>(placed.x),
+                                   static_cast<uint32_t>(placed.y)};
+        errorHandler(xcb_configure_window(conn, client.frame,
+                                          XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values),
+                     "move frame onto output");
+        client.frame_pos = Position<int16_t>(placed.x, placed.y);
+        queueConfigureNotify(client);
+        ++moved;
+    }
+    WM_LOG(INFO, "Outputs changed, moved {} windows onto them", moved);
+}
+
+void WindowManager::initEwmh()
+{
+    // A child of the root which names the WM, and proves that it is alive.
+    wm_check_ = xcb_generate_id(conn);
+    errorHandler(xcb_create_window(conn, XCB_COPY_FROM_PARENT, wm_check_, root, -1, -1, 1, 1, 0,
+                                   XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+                                   XCB_CW_OVERRIDE_REDIRECT, (const uint32_t[]){1}),
+                 "create supporting WM check window");
+    for (const xcb_window_t w : {root, wm_check_})
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, w,
+                                         atoms_[Atom::NET_SUPPORTING_WM_CHECK], XCB_ATOM_WINDOW,
+                                         32, 1, &wm_check_),
+                     "set _NET_SUPPORTING_WM_CHECK");
+    static const char name[] = "tinywm";
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, wm_check_,
+                                     atoms_[Atom::NET_WM_NAME], atoms_[Atom::UTF8_STRING], 8,
+                                     sizeof(name) - 1, name),
+                 "set _NET_WM_NAME");
+
+    const xcb_atom_t supported[] = {
+        atoms_[Atom::NET_SUPPORTED],
+        atoms_[Atom::NET_SUPPORTING_WM_CHECK],
+        atoms_[Atom::NET_CLIENT_LIST],
+        atoms_[Atom::NET_CLIENT_LIST_STACKING],
+        atoms_[Atom::NET_ACTIVE_WINDOW],
+        atoms_[Atom::NET_WM_NAME],
+        atoms_[Atom::NET_NUMBER_OF_DESKTOPS],
+        atoms_[Atom::NET_CURRENT_DESKTOP],
+        atoms_[Atom::NET_WM_DESKTOP],
+        atoms_[Atom::NET_WM_SYNC_REQUEST],
+    };
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                     atoms_[Atom::NET_SUPPORTED], XCB_ATOM_ATOM, 32,
+                                     sizeof(supported) / sizeof(supported[0]), supported),
+                 "set _NET_SUPPORTED");
+    const uint32_t desktops = static_cast<uint32_t>(focus_order_.size());
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                     atoms_[Atom::NET_NUMBER_OF_DESKTOPS], XCB_ATOM_CARDINAL,
+                                     32, 1, &desktops),
+                 "set _NET_NUMBER_OF_DESKTOPS");
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                     atoms_[Atom::NET_CURRENT_DESKTOP], XCB_ATOM_CARDINAL, 32,
+                                     1, &published_desktop_),
+                 "set _NET_CURRENT_DESKTOP");
+    // Nothing of a previous WM is left over in the lists.
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                     atoms_[Atom::NET_ACTIVE_WINDOW], XCB_ATOM_WINDOW, 32, 1,
+                                     &published_active_),
+                 "set _NET_ACTIVE_WINDOW");
+    for (const Atom list : {Atom::NET_CLIENT_LIST, Atom::NET_CLIENT_LIST_STACKING})
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root, atoms_[list],
+                                         XCB_ATOM_WINDOW, 32, 0, nullptr),
+                     "clear client list");
+}
+
+void WindowManager::publishEwmh()
+{
+    // _NET_CLIENT_LIST is in the order the clients were framed.
+    if (clients_dirty_) {
+        clients_dirty_ = false;
+        publishList(Atom::NET_CLIENT_LIST, tile_order_, published_clients_);
+    }
+    if (stacking_dirty_) {
+        stacking_dirty_ = false;
+        scratch_list_.assign(stacking_.begin(), stacking_.end());
+        publishList(Atom::NET_CLIENT_LIST_STACKING, scratch_list_, published_stacking_);
+    }
+    if (published_desktop_ != current_desktop_) {
+        published_desktop_ = current_desktop_;
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                         atoms_[Atom::NET_CURRENT_DESKTOP], XCB_ATOM_CARDINAL,
+                                         32, 1, &published_desktop_),
+                     "set _NET_CURRENT_DESKTOP");
+    }
+    if (published_active_ != focused_) {
+        published_active_ = focused_;
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root,
+                                         atoms_[Atom::NET_ACTIVE_WINDOW], XCB_ATOM_WINDOW, 32,
+                                         1, &published_active_),
+                     "set _NET_ACTIVE_WINDOW");
+    }
+}
+
+void WindowManager::publishList(Atom property, const std::vector<xcb_window_t> &current,
+                                std::vector<xcb_window_t> &published)
+{
+    if (current == published)
+        return;
+    const bool grown = current.size() > published.size()
+                       && std::equal(published.begin(), published.end(), current.begin());
+    if (grown) {
+        const size_t from = published.size();
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_APPEND, root, atoms_[property],
+                                         XCB_ATOM_WINDOW, 32, current.size() - from,
+                                         current.data() + from),
+                     "append to client list");
+    } else {
+        errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, root, atoms_[property],
+                                         XCB_ATOM_WINDOW, 32, current.size(), current.data()),
+                     "set client list");
+    }
+    WM_LOG(DEBUG, "{} {} with {} windows", grown ? "Appended" : "Rewrote",
+           Atoms::name(property), current.size());
+    published = current;
+}
+
+void WindowManager::adoptWindows()
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point adopt_start = Clock::now();
+
+    errorHandler(xcb_grab_server(conn), "grab X Server");
+    const Clock::time_point grab_start = Clock::now();
 
     xcb_generic_error_t *error = nullptr;
-    xcb_get_window_attributes_reply_t *result_attr =
-        xcb_get_window_attributes_reply(conn, xcb_get_window_attributes(conn, w),
-                                        &error);
-    errorHandler(error, "get window attributes");
-    // Make sure the window is managed by WM, and it must be currently visiable.
-    if (created_before && (result_attr->override_redirect == XCB_CW_OVERRIDE_REDIRECT || result_attr->map_state != XCB_MAP_STATE_VIEWABLE)) {
+    metrics_.roundTrip();
+    xcb_query_tree_reply_t *result_tree =
+        xcb_query_tree_reply(conn, xcb_query_tree(conn, root), &error);
+    errorHandler(error, "query for window tree");
+
+    WM_LOG(INFO, "Root {} has {} children", root, result_tree->children_len);
+    xcb_window_t *children = xcb_query_tree_children(result_tree);
+    const uint16_t children_len = result_tree->children_len;
+    // 1. Fire the attribute requests of all children at once, and keep the
+    // windows which are managed by WM and currently visible. The others are
+    // left alone: no event selection, no more requests.
+    std::vector<xcb_get_window_attributes_cookie_t> attr_cookies(children_len);
+    for (uint16_t i = 0; i < children_len; ++i)
+        attr_cookies[i] = xcb_get_window_attributes(conn, children[i]);
+    std::vector<xcb_window_t> managed;
+    if (children_len != 0)
+        metrics_.roundTrip();
+    for (uint16_t i = 0; i < children_len; ++i) {
+        xcb_get_window_attributes_reply_t *result_attr =
+            xcb_get_window_attributes_reply(conn, attr_cookies[i], &error);
+        free(error);
+        if (result_attr && !result_attr->override_redirect
+            && result_attr->map_state == XCB_MAP_STATE_VIEWABLE)
+            managed.push_back(children[i]);
         free(result_attr);
-        return;
     }
-    free(result_attr);
-    // 1. Get the geometry of client window, so we can use it to create frame
-    xcb_get_geometry_reply_t *result_geo =
-        xcb_get_geometry_reply(conn, xcb_get_geometry(conn, w), &error);
-    errorHandler(error, "get geometry");
-    // 2. Create a frame.
+    // 2. Fire the geometry and property requests of those at once, then
+    // frame them. Nothing is flushed until all frames are queued.
+    std::vector<xcb_get_geometry_cookie_t> geo_cookies(managed.size());
+    std::vector<PropertyCookies> prop_cookies(managed.size());
+    for (size_t i = 0; i < managed.size(); ++i) {
+        geo_cookies[i] = xcb_get_geometry(conn, managed[i]);
+        prop_cookies[i] = requestProperties(managed[i]);
+    }
+    uint16_t adopted = 0;
+    if (!managed.empty())
+        metrics_.roundTrip();
+    for (size_t i = 0; i < managed.size(); ++i) {
+        xcb_get_geometry_reply_t *result_geo =
+            xcb_get_geometry_reply(conn, geo_cookies[i], &error);
+        free(error);
+        if (result_geo) {
+            Client &client = addFrame(managed[i], result_geo, prop_cookies[i]);
+            client.mapped = true;
+            ++adopted;
+        } else {
+            discardProperties(prop_cookies[i]);
+        }
+        free(result_geo);
+    }
+    // free(children); // 不需要释放这个数组
+    free(result_tree);
+
+    // 3. Send the whole batch together with the ungrab.
+    errorHandler(xcb_ungrab_server(conn), "ungrab X Server");
+    flush();
+
+    const Clock::time_point adopt_end = Clock::now();
+    WM_LOG(INFO, "Adopted {} of {} windows in {} us, server grabbed for {} us",
+           adopted, children_len,
+           std::chrono::duration_cast<std::chrono::microseconds>(adopt_end - adopt_start).count(),
+           std::chrono::duration_cast<std::chrono::microseconds>(adopt_end - grab_start).count());
+}
+
+Client &WindowManager::addFrame(xcb_window_t w, const xcb_get_geometry_reply_t *result_geo,
+                                const PropertyCookies &cookies)
+{
+    // Forbid multiple frame.
+    auto existing = clients_.find(w);
+    if (existing != clients_.end()) {
+        WM_LOG(WARNING, "Window {} is framed already [{}]", w, existing->second.frame);
+        return existing->second;
+    }
+
+    // 1. Create a frame with the geometry of client window.
     xcb_window_t frame = xcb_generate_id(conn);
     uint32_t mask;
     uint32_t values[3];
-    mask = XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK;
-    values[0] = static_cast<uint32_t>(Colors::GREEN);
-    values[1] = static_cast<uint32_t>(Colors::GREY);
-    values[2] =
+    // No background and no Expose: the decoration pixmap installed below is
+    // the background, so the server repaints the frame by itself.
+    mask = XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK | XCB_CW_CURSOR;
+    values[0] = static_cast<uint32_t>(Colors::GREY);
+    values[1] =
         // XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE |
-        XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_LEAVE_WINDOW | XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
-    errorHandler(xcb_create_window_checked(
-                     conn, result_geo->depth, frame, root, result_geo->x,
-                     result_geo->y, result_geo->width, result_geo->height,
-                     BORDER_WIDTH, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+        XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_LEAVE_WINDOW | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
+    // The server shows the frame's cursor by itself when the pointer enters.
+    values[2] = (*cursors_)[CursorType::NORMAL];
+    // The frame has the depth of the root, like the decoration pixmap and the
+    // GCs drawing it, whatever the depth of the client is.
+    errorHandler(xcb_create_window(
+                     conn, XCB_COPY_FROM_PARENT, frame, root, result_geo->x,
+                     result_geo->y, result_geo->width, result_geo->height + TITLE_HEIGHT,
+                     FRAME_BORDER_WIDTH, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
                      XCB_COPY_FROM_PARENT, mask, values),
                  "create frame");
-    free(result_geo);
     // Configure window title
     const std::string title = std::string("WID: ").append(toString(w));
     const char title_icon[] = "XCB tinywm (iconified)";
@@ -263,83 +732,379 @@ void WindowManager::addFrame(xcb_window_t w, bool created_before)
                                      XCB_ATOM_WM_ICON_NAME, XCB_ATOM_STRING, 8,
                                      strlen(title_icon), title_icon),
                  "configure window icon name");
-    // 3. Add client window to save set.
-    errorHandler(xcb_change_save_set_checked(conn, XCB_SET_MODE_INSERT, w),
+    // 2. Add client window to save set.
+    errorHandler(xcb_change_save_set(conn, XCB_SET_MODE_INSERT, w),
                  "add client window to save set");
-    // 4. Reparent client window with frame window.
-    errorHandler(xcb_reparent_window_checked(conn, w, frame, 0, 0),
+    // 3. Reparent client window with frame window, below the title bar.
+    errorHandler(xcb_reparent_window(conn, w, frame, 0, TITLE_HEIGHT),
                  "reparent client window with frame window");
-    // 5. Map frame.
-    errorHandler(xcb_map_window_checked(conn, frame),
+    Client &client = clients_[w];
+    client.window = w;
+    client.frame = frame;
+    client.frame_pos = Position<int16_t>(result_geo->x, result_geo->y);
+    client.frame_size = Size<uint16_t>(result_geo->width, result_geo->height + TITLE_HEIGHT);
+    client.frame_border = FRAME_BORDER_WIDTH;
+    client.border_width = result_geo->border_width;
+    client.pos = Position<int16_t>(0, TITLE_HEIGHT);
+    client.size = Size<uint16_t>(result_geo->width, result_geo->height);
+    frames_[frame] = w;
+    // Never focused yet, so the least recently used.
+    client.desktop = current_desktop_;
+    client.focus_entry = focusOrder().insert(focusOrder().end(), w);
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, w,
+                                     atoms_[Atom::NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 32, 1,
+                                     &client.desktop),
+                 "set _NET_WM_DESKTOP");
+    clients_dirty_ = stacking_dirty_ = true;
+    // A new window is stacked on top of its siblings.
+    client.stack_entry = stacking_.insert(stacking_.end(), w);
+    tile_order_.push_back(w);
+    relayout_ = true;
+    readProperties(client, cookies);
+    // 4. Decorate and map frame.
+    renderDecoration(client);
+    errorHandler(xcb_map_window(conn, frame),
                  "map frame and client window");
-    clients_[w] = frame;
-    // 6. Grab universal window management actions on client window.
-    // 6.1 Move windows with alt + left button.
-    errorHandler(xcb_grab_button_checked(
-                     conn, 0, w,
-                     XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION,
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE,
-                     XCB_BUTTON_INDEX_1, XCB_MOD_MASK_1),
-                 "grab alt + button1");
-    // 6.2  Resize windows with alt + right button.
-    errorHandler(xcb_grab_button_checked(
-                     conn, 0, w,
-                     XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION,
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, w, XCB_NONE,
-                     XCB_BUTTON_INDEX_3, XCB_MOD_MASK_1),
-                 "grab alt + button3");
-    // 6.3 Kill windows with alt + middle button
-    errorHandler(xcb_grab_button_checked(
-                     conn, 0, w,
-                     XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION,
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, w, XCB_NONE,
-                     XCB_BUTTON_INDEX_2, XCB_MOD_MASK_1),
-                 "grab alt + button2");
-    // errorHandler(xcb_ungrab_key_checked(conn, xcb_keycode_), "grab key");
-    // 6.4 Switch windows with ctrl.
-    errorHandler(xcb_grab_key_checked(conn, 1, w, XCB_MOD_MASK_CONTROL, XCB_NONE,
+    WM_LOG(INFO, "Framed window {} [{}]", w, frame);
+    return client;
+}
+
+void WindowManager::grabBindings()
+{
+    // Grabs on the root are inherited by every window below it, so they are
+    // registered once and the cost of framing doesn't grow with the bindings.
+    const uint16_t button_mask =
+        XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION;
+    for (const uint16_t locks : keyboard_->lockCombinations()) {
+        // Move windows with alt + left button.
+        errorHandler(xcb_grab_button(conn, 0, root, button_mask, XCB_GRAB_MODE_ASYNC,
+                                     XCB_GRAB_MODE_ASYNC, XCB_NONE,
+                                     (*cursors_)[CursorType::MOVE], XCB_BUTTON_INDEX_1,
+                                     XCB_MOD_MASK_1 | locks),
+                     "grab alt + button1");
+        // Resize windows with alt + right button.
+        errorHandler(xcb_grab_button(conn, 0, root, button_mask, XCB_GRAB_MODE_ASYNC,
+                                     XCB_GRAB_MODE_ASYNC, XCB_NONE,
+                                     (*cursors_)[CursorType::RESIZE_BOTTOM_RIGHT],
+                                     XCB_BUTTON_INDEX_3, XCB_MOD_MASK_1 | locks),
+                     "grab alt + button3");
+        // Close windows with alt + middle button.
+        errorHandler(xcb_grab_button(conn, 0, root, button_mask, XCB_GRAB_MODE_ASYNC,
+                                     XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE,
+                                     XCB_BUTTON_INDEX_2, XCB_MOD_MASK_1 | locks),
+                     "grab alt + button2");
+    }
+    grabKeys();
+}
+
+void WindowManager::grabKeys()
+{
+    for (const auto &grab : keyboard_->grabs()) {
+        for (const uint16_t locks : keyboard_->lockCombinations())
+            errorHandler(xcb_grab_key(conn, 1, root, grab.second | locks, grab.first,
                                       XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC),
-                 "grab ctrl");
-    xcb_flush(conn);
-    LOG(INFO) << "Framed window " << w << " [" << frame << "]";
+                         "grab key");
+    }
 }
 
-void WindowManager::unFrame(xcb_window_t w)
+void WindowManager::unFrame(xcb_window_t w, bool destroyed)
 {
-    CHECK(clients_.count(w));
+    auto found = clients_.find(w);
+    if (found == clients_.end()) {
+        WM_LOG(WARNING, "Window {} is not framed", w);
+        return;
+    }
+    const xcb_window_t frame = found->second.frame;
+    const xcb_pixmap_t decoration = found->second.decoration;
+    const bool visible = found->second.desktop == current_desktop_;
+    focus_order_[found->second.desktop].erase(found->second.focus_entry);
+    stacking_.erase(found->second.stack_entry);
+    clients_dirty_ = stacking_dirty_ = true;
+    tile_order_.erase(std::find(tile_order_.begin(), tile_order_.end(), w));
+    relayout_ = true;
     // 1. Unmap frame.
-    errorHandler(xcb_unmap_window_checked(conn, clients_[w]), "unmap frame");
-    // 2. Reparent client window.
-    errorHandler(xcb_reparent_window_checked(conn, w, root, 0, 0),
-                 "reparent client window");
-    // 3. Remove client windom from save set.
-    errorHandler(xcb_change_save_set_checked(conn, XCB_SET_MODE_DELETE, w),
-                 "remove client window from save set");
+    errorHandler(xcb_unmap_window(conn, frame), "unmap frame");
+    // A destroyed window has left the frame and the save set by itself.
+    if (!destroyed) {
+        // 2. Reparent client window.
+        errorHandler(xcb_reparent_window(conn, w, root, 0, 0),
+                     "reparent client window");
+        // 3. Remove client windom from save set.
+        errorHandler(xcb_change_save_set(conn, XCB_SET_MODE_DELETE, w),
+                     "remove client window from save set");
+        // A withdrawn window belongs to no desktop (EWMH).
+        errorHandler(xcb_delete_property(conn, w, atoms_[Atom::NET_WM_DESKTOP]),
+                     "remove _NET_WM_DESKTOP");
+    }
     // 4. Destroy frame.
-    errorHandler(xcb_destroy_window_checked(conn, clients_[w]), "destroy frame");
-    clients_.erase(w);
-    xcb_flush(conn);
-    LOG(INFO) << "Unframed window " << w << " [" << clients_[w] << "]";
+    errorHandler(xcb_destroy_window(conn, frame), "destroy frame");
+    errorHandler(xcb_free_pixmap(conn, decoration), "free decoration");
+    if (found->second.sync_alarm != XCB_NONE)
+        errorHandler(xcb_sync_destroy_alarm(conn, found->second.sync_alarm),
+                     "destroy sync alarm");
+    if (drag_window_ == w) {
+        drawOutline(Rect());
+        drag_window_ = XCB_NONE;
+    }
+    if (cycle_target_ == w)
+        cycle_target_ = XCB_NONE;
+    clients_.erase(found);
+    frames_.erase(frame);
+    WM_LOG(INFO, "Unframed window {} [{}]", w, frame);
+    // Hand the focus on to the most recently used window left, unless an
+    // Alt+Tab cycle is about to choose one.
+    if (focused_ == w) {
+        focused_ = XCB_NONE;
+        if (visible && cycle_modifiers_ == 0)
+            focusLastUsed(XCB_CURRENT_TIME);
+    }
 }
 
-void WindowManager::onClientMessage(xcb_client_message_event_t *ev)
+PropertyCookies WindowManager::requestProperties(xcb_window_t w)
 {
-    void *message = nullptr;
-    switch (ev->format) {
-    case 8:
-        message = ev->data.data8;
+    // Selected before the requests, so that no change between them and the
+    // replies goes unnoticed.
+    errorHandler(xcb_change_window_attributes(conn, w, XCB_CW_EVENT_MASK,
+                                              (const uint32_t[]){XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_FOCUS_CHANGE}),
+                 "select client property changes");
+    PropertyCookies cookies;
+    for (size_t i = 0; i < cookies.cookies.size(); ++i)
+        cookies.cookies[i] = requestProperty(w, static_cast<ClientProperty>(i));
+    return cookies;
+}
+
+void WindowManager::readProperties(Client &client, const PropertyCookies &cookies)
+{
+    // Sent with the caller's other requests, whose first reply already
+    // counted the round trip.
+    for (size_t i = 0; i < cookies.cookies.size(); ++i) {
+        xcb_get_property_reply_t *reply =
+            xcb_get_property_reply(conn, cookies.cookies[i], nullptr);
+        applyProperty(client, static_cast<ClientProperty>(i), reply);
+        free(reply);
+    }
+}
+
+void WindowManager::discardProperties(const PropertyCookies &cookies)
+{
+    for (const xcb_get_property_cookie_t &cookie : cookies.cookies)
+        xcb_discard_reply(conn, cookie.sequence);
+}
+
+xcb_atom_t WindowManager::propertyAtom(ClientProperty property) const noexcept
+{
+    switch (property) {
+    case ClientProperty::WM_NAME:
+        return XCB_ATOM_WM_NAME;
+    case ClientProperty::NET_WM_NAME:
+        return atoms_[Atom::NET_WM_NAME];
+    case ClientProperty::WM_CLASS:
+        return XCB_ATOM_WM_CLASS;
+    case ClientProperty::WM_HINTS:
+        return XCB_ATOM_WM_HINTS;
+    case ClientProperty::WM_NORMAL_HINTS:
+        return XCB_ATOM_WM_NORMAL_HINTS;
+    case ClientProperty::WM_PROTOCOLS:
+        return atoms_[Atom::WM_PROTOCOLS];
+    case ClientProperty::WM_TRANSIENT_FOR:
+        return XCB_ATOM_WM_TRANSIENT_FOR;
+    case ClientProperty::NET_WM_WINDOW_TYPE:
+        return atoms_[Atom::NET_WM_WINDOW_TYPE];
+    case ClientProperty::NET_WM_SYNC_REQUEST_COUNTER:
+        return atoms_[Atom::NET_WM_SYNC_REQUEST_COUNTER];
+    case ClientProperty::COUNT:
+        break;
+    }
+    return XCB_NONE;
+}
+
+xcb_get_property_cookie_t WindowManager::requestProperty(xcb_window_t w, ClientProperty property)
+{
+    // Long enough for any sane value, in 32-bit units.
+    uint32_t length = 256;
+    if (property == ClientProperty::WM_HINTS)
+        length = XCB_ICCCM_NUM_WM_HINTS_ELEMENTS;
+    else if (property == ClientProperty::WM_NORMAL_HINTS)
+        length = XCB_ICCCM_NUM_WM_SIZE_HINTS_ELEMENTS;
+    else if (property == ClientProperty::WM_TRANSIENT_FOR
+             || property == ClientProperty::NET_WM_SYNC_REQUEST_COUNTER)
+        length = 1;
+    return xcb_get_property(conn, 0, w, propertyAtom(property), XCB_GET_PROPERTY_TYPE_ANY, 0,
+                            length);
+}
+
+bool WindowManager::applyProperty(Client &client, ClientProperty property,
+                                  const xcb_get_property_reply_t *reply)
+{
+    // A deleted property reads like an empty one.
+    const bool set = reply && reply->type != XCB_NONE;
+    const char *text = set && reply->format == 8
+                           ? static_cast<const char *>(xcb_get_property_value(reply))
+                           : nullptr;
+    const int text_length = text ? xcb_get_property_value_length(reply) : 0;
+    const xcb_atom_t *atoms = set && reply->format == 32
+                                  ? static_cast<const xcb_atom_t *>(xcb_get_property_value(reply))
+                                  : nullptr;
+    const xcb_atom_t *atoms_end = atoms ? atoms + xcb_get_property_value_length(reply) / 4 : nullptr;
+    const std::string title = client.title;
+    const bool floating = client.floating;
+
+    switch (property) {
+    case ClientProperty::WM_NAME:
+        // STRING is Latin-1 already, some clients set UTF8_STRING.
+        client.wm_name.assign(text ? text : "", text_length);
+        if (reply && reply->type == atoms_[Atom::UTF8_STRING])
+            client.wm_name = latin1_from_utf8(client.wm_name);
         break;
-    case 16:
-        message = ev->data.data16;
+    case ClientProperty::NET_WM_NAME:
+        client.net_wm_name.assign(text ? text : "", text_length);
         break;
-    case 32:
-        message = ev->data.data32;
+    case ClientProperty::WM_CLASS: {
+        // Two strings, each ended by a NUL.
+        client.instance_name.assign(text ? text : "", strnlen(text ? text : "", text_length));
+        const size_t offset = std::min<size_t>(client.instance_name.size() + 1, text_length);
+        client.class_name.assign(text ? text + offset : "",
+                                 strnlen(text ? text + offset : "", text_length - offset));
         break;
-    default:
-        const char *(message) = "DATA ERROR!";
     }
-    LOG(WARNING) << "WM listen a ClientMessage from " << ev->window
-                 << ", content is " << ev->type << " : " << message;
+    case ClientProperty::WM_HINTS: {
+        xcb_icccm_wm_hints_t hints;
+        if (set && xcb_icccm_get_wm_hints_from_reply(
+                       &hints, const_cast<xcb_get_property_reply_t *>(reply))) {
+            client.input = !(hints.flags & XCB_ICCCM_WM_HINT_INPUT) || hints.input;
+            client.urgent = hints.flags & XCB_ICCCM_WM_HINT_X_URGENCY;
+        } else {
+            client.input = true;
+            client.urgent = false;
+        }
+        break;
+    }
+    case ClientProperty::WM_NORMAL_HINTS:
+        if (!set || !xcb_icccm_get_wm_size_hints_from_reply(
+                        &client.normal_hints, const_cast<xcb_get_property_reply_t *>(reply)))
+            client.normal_hints = xcb_size_hints_t();
+        break;
+    case ClientProperty::WM_PROTOCOLS:
+        client.delete_window =
+            atoms && std::find(atoms, atoms_end, atoms_[Atom::WM_DELETE_WINDOW]) != atoms_end;
+        client.take_focus =
+            atoms && std::find(atoms, atoms_end, atoms_[Atom::WM_TAKE_FOCUS]) != atoms_end;
+        client.sync_request =
+            atoms && std::find(atoms, atoms_end, atoms_[Atom::NET_WM_SYNC_REQUEST]) != atoms_end;
+        break;
+    case ClientProperty::WM_TRANSIENT_FOR:
+        client.transient_for = atoms != atoms_end ? *atoms : XCB_NONE;
+        break;
+    case ClientProperty::NET_WM_WINDOW_TYPE:
+        client.window_type = atoms != atoms_end ? *atoms : XCB_NONE;
+        break;
+    case ClientProperty::NET_WM_SYNC_REQUEST_COUNTER: {
+        const xcb_sync_counter_t counter = atoms != atoms_end ? *atoms : XCB_NONE;
+        // An alarm watches one counter, a new one gets a new alarm.
+        if (counter != client.sync_counter && client.sync_alarm != XCB_NONE) {
+            errorHandler(xcb_sync_destroy_alarm(conn, client.sync_alarm), "destroy sync alarm");
+            client.sync_alarm = XCB_NONE;
+        }
+        client.sync_counter = counter;
+        break;
+    }
+    case ClientProperty::COUNT:
+        break;
+    }
+
+    client.floating = client.transient_for != XCB_NONE
+                      || (client.window_type != XCB_NONE
+                          && client.window_type != atoms_[Atom::NET_WM_WINDOW_TYPE_NORMAL]);
+    if (client.floating != floating)
+        relayout_ = true;
+    client.title = client.net_wm_name.empty() ? client.wm_name
+                                              : latin1_from_utf8(client.net_wm_name);
+    return client.title != title;
+}
+
+void WindowManager::readPendingProperties()
+{
+    // All the requests are out, one round trip for all the replies.
+    if (!pending_properties_.empty())
+        metrics_.roundTrip();
+    for (const PendingProperty &pending : pending_properties_) {
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, pending.cookie, nullptr);
+        // The window may have been unframed since.
+        auto found = clients_.find(pending.window);
+        if (found != clients_.end() && applyProperty(found->second, pending.property, reply))
+            renderDecoration(found->second);
+        free(reply);
+    }
+    pending_properties_.clear();
+}
+
+Client *WindowManager::findClient(xcb_window_t w)
+{
+    auto client = clients_.find(w);
+    if (client != clients_.end())
+        return &client->second;
+    auto frame = frames_.find(w);
+    if (frame != frames_.end())
+        return &clients_.at(frame->second);
+    return nullptr;
+}
+
+void WindowManager::raise(Client &client)
+{
+    errorHandler(xcb_configure_window(conn, client.frame, XCB_CONFIG_WINDOW_STACK_MODE,
+                                      (const uint32_t[]){XCB_STACK_MODE_ABOVE}),
+                 "raise frame");
+    stacking_.splice(stacking_.end(), stacking_, client.stack_entry);
+    stacking_dirty_ = true;
+}
+
+void WindowManager::restack(const std::vector<xcb_window_t> &order)
+{
+    const Client *below = nullptr;
+    size_t restacked = 0;
+    for (const xcb_window_t w : order) {
+        auto found = clients_.find(w);
+        if (found == clients_.end())
+            continue;
+        Client &client = found->second;
+        if (below != nullptr
+            && (client.stack_entry == stacking_.begin()
+                || std::prev(client.stack_entry) != below->stack_entry)) {
+            const uint32_t values[] = {below->frame, XCB_STACK_MODE_ABOVE};
+            errorHandler(xcb_configure_window(conn, client.frame,
+                                              XCB_CONFIG_WINDOW_SIBLING
+                                                  | XCB_CONFIG_WINDOW_STACK_MODE,
+                                              values),
+                         "restack frame");
+            stackAbove(client, below);
+            ++restacked;
+        }
+        below = &client;
+    }
+    WM_LOG(DEBUG, "Restacked {} of {} frames", restacked, order.size());
+}
+
+void WindowManager::stackAbove(Client &client, const Client *below)
+{
+    stacking_.splice(below ? std::next(below->stack_entry) : stacking_.begin(), stacking_,
+                     client.stack_entry);
+    stacking_dirty_ = true;
+}
+
+void WindowManager::onClientMessage(xcb_client_message_event_t *ev)
+{
+    WM_LOG(DEBUG, "ClientMessage {} (format {}) to window {}", ev->type, ev->format,
+           ev->window);
+    // Requests of pagers and other tools, EWMH "Root Window Messages".
+    if (ev->format != 32)
+        return;
+    if (ev->type == atoms_[Atom::NET_CURRENT_DESKTOP]) {
+        switchDesktop(ev->data.data32[0], ev->data.data32[1]);
+    } else if (ev->type == atoms_[Atom::NET_WM_DESKTOP]) {
+        auto found = clients_.find(ev->window);
+        if (found != clients_.end())
+            moveToDesktop(found->second, ev->data.data32[0]);
+    }
 }
 
 void WindowManager::onCreateNotify(xcb_create_notify_event_t *ev)
@@ -348,28 +1113,68 @@ void WindowManager::onCreateNotify(xcb_create_notify_event_t *ev)
 
 void WindowManager::onDestroyNotify(xcb_destroy_notify_event_t *ev)
 {
+    // A mapped client is unframed on its UnmapNotify already, a client hidden
+    // on another desktop has none to send.
+    if (clients_.count(ev->window))
+        unFrame(ev->window, true);
 }
 
 void WindowManager::onConfigureNotify(xcb_configure_notify_event_t *ev)
 {
+    auto frame = frames_.find(ev->window);
+    if (frame != frames_.end()) {
+        Client &client = clients_.at(frame->second);
+        client.frame_pos = Position<int16_t>(ev->x, ev->y);
+        client.frame_size = Size<uint16_t>(ev->width, ev->height);
+        client.frame_border = ev->border_width;
+        client.above_sibling = ev->above_sibling;
+        // Frames stacked above windows we don't manage keep their place in
+        // the local order, which only orders the frames among themselves.
+        if (ev->above_sibling == XCB_NONE) {
+            stackAbove(client, nullptr);
+        } else {
+            auto below = frames_.find(ev->above_sibling);
+            if (below != frames_.end())
+                stackAbove(client, &clients_.at(below->second));
+        }
+        if (client.frame_size.width != client.decoration_width)
+            renderDecoration(client);
+        return;
+    }
+    auto client = clients_.find(ev->window);
+    if (client != clients_.end() && ev->event == client->second.frame) {
+        client->second.pos = Position<int16_t>(ev->x, ev->y);
+        client->second.size = Size<uint16_t>(ev->width, ev->height);
+    }
 }
 
 void WindowManager::onMapNotify(xcb_map_notify_event_t *ev)
 {
+    auto client = clients_.find(ev->window);
+    if (client != clients_.end())
+        client->second.mapped = true;
 }
 
 void WindowManager::onUnmapNotify(xcb_unmap_notify_event_t *ev)
 {
     if (!clients_.count(ev->window)) {
-        LOG(INFO) << "Ignore UnmapNotify for non-client window " << ev->window;
+        WM_LOG(DEBUG, "Ignore UnmapNotify for non-client window {}", ev->window);
+        return;
+    }
+    Client &client = clients_[ev->window];
+    // A hidden client withdrawing can't unmap again, ICCCM has it send a
+    // synthetic UnmapNotify to the root instead.
+    if (ev->event == root && !(ev->response_type & 0x80)) {
+        WM_LOG(DEBUG, "Ignore UnmapNotify for reparented pre-existing window {}",
+               ev->window);
         return;
     }
-    if (ev->event == root) {
-        LOG(INFO) << "Ignore UnmapNotify for reparented pre-existing window "
-                  << ev->window;
+    if (ev->event != root && client.ignore_unmaps > 0) {
+        --client.ignore_unmaps;
         return;
     }
-    unFrame(ev->window);
+    client.mapped = false;
+    unFrame(ev->window, false);
 }
 
 void WindowManager::onReparentNotify(xcb_reparent_notify_event_t *ev)
@@ -378,297 +1183,737 @@ void WindowManager::onReparentNotify(xcb_reparent_notify_event_t *ev)
 
 void WindowManager::onExpose(xcb_expose_event_t *ev)
 {
-    xcb_generic_error_t *error = nullptr;
-    xcb_get_property_reply_t *result_prop = xcb_get_property_reply(
-        conn,
-        xcb_get_property(conn, 0, ev->window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING,
-                         0, 64),
-        &error);
-    errorHandler(error, "get window name");
-    const char *text = nullptr;
-    // free(result_atom);
-    free(result_prop);
-    if (!clients_.count(ev->window)) {
-        text = static_cast<const char *>(xcb_get_property_value(result_prop));
-        button_draw(conn, screen, ev->window, (ev->width - 7 * strlen(text)) / 2,
-                    (ev->height - 16) / 2, text);
-        LOG(WARNING) << text;
-        text = "Press ESC key to exit...";
-        text_draw(conn, screen, ev->window, 10, ev->height - 10, text);
-        // text_draw(conn, screen, clients_[ev->window], (ev->x + ev->width) >> 1,
-        // (ev->y + ev->height) >> 1, text);
-        xcb_rectangle_t btn = {static_cast<int16_t>((ev->x + ev->width) >> 1),
-                               static_cast<int16_t>((ev->y + ev->height) >> 1), 15,
-                               15}; // ev->x + 2 ev->y + ev->ev->width - 8
-        xcb_poly_fill_rectangle(conn, ev->window, xcb_generate_id(conn), 1, &btn);
-        LOG(WARNING) << text;
-        xcb_flush(conn);
-    }
-    printf(
-        "Window %u [%s] exposed. Region to be redrawn at location "
-        "(%d,%d), with dimension (%d,%d)\n",
-        ev->window, text, ev->x, ev->y, ev->width, ev->height);
+}
+
+void WindowManager::onPropertyNotify(xcb_property_notify_event_t *ev)
+{
+    auto found = clients_.find(ev->window);
+    if (found == clients_.end())
+        return;
+    size_t i = 0;
+    while (i < static_cast<size_t>(ClientProperty::COUNT)
+           && ev->atom != propertyAtom(static_cast<ClientProperty>(i)))
+        ++i;
+    if (i == static_cast<size_t>(ClientProperty::COUNT))
+        return;
+    const ClientProperty property = static_cast<ClientProperty>(i);
+    auto pending = std::find_if(pending_properties_.begin(), pending_properties_.end(),
+                                [ev, property](const PendingProperty &p) {
+                                    return p.window == ev->window && p.property == property;
+                                });
+    if (ev->state == XCB_PROPERTY_DELETE) {
+        // Nothing to ask the server, and an earlier fetch is outdated.
+        if (pending != pending_properties_.end()) {
+            xcb_discard_reply(conn, pending->cookie.sequence);
+            pending_properties_.erase(pending);
+        }
+        if (applyProperty(found->second, property, nullptr))
+            renderDecoration(found->second);
+        return;
+    }
+    // Only the changed property is fetched again, its reply is read with the
+    // others of the batch.
+    if (pending == pending_properties_.end())
+        pending_properties_.push_back({ev->window, property, requestProperty(ev->window, property)});
+}
+
+void WindowManager::renderDecoration(Client &client)
+{
+    // 1. A new width needs a new pixmap, the old one is freed once replaced.
+    const uint16_t width = client.frame_size.width ? client.frame_size.width : 1;
+    const xcb_pixmap_t old = client.decoration;
+    if (old == XCB_NONE || width != client.decoration_width) {
+        client.decoration = xcb_generate_id(conn);
+        client.decoration_width = width;
+        errorHandler(xcb_create_pixmap(conn, screen->root_depth, client.decoration,
+                                       root, width, TITLE_HEIGHT),
+                     "create decoration");
+    }
+    // 2. Draw the title bar into it.
+    decoration_draw(*decorations_, client.decoration, width, TITLE_HEIGHT,
+                    client.title.empty() ? "WID: " + toString(client.window) : client.title,
+                    client.focused);
+    // 3. Install it as the frame background, and let the server repaint.
+    if (client.decoration != old) {
+        errorHandler(xcb_change_window_attributes(conn, client.frame, XCB_CW_BACK_PIXMAP,
+                                                  &client.decoration),
+                     "set decoration");
+        if (old != XCB_NONE)
+            errorHandler(xcb_free_pixmap(conn, old), "free decoration");
+    }
+    errorHandler(xcb_clear_area(conn, 0, client.frame, 0, 0, width, TITLE_HEIGHT),
+                 "repaint decoration");
 }
 
 void WindowManager::onConfigureRequest(xcb_configure_request_event_t *ev)
 {
-    printf("Captured Configure request from window %u!\n", ev->window);
-    LOG(WARNING) << "ALL window: ";
-    for (auto ele : clients_)
-        LOG(INFO) << ele.first << " ^ " << ele.second;
-    LOG(WARNING) << "current: " << ev->parent << " | " << ev->window;
-    CHECK(clients_.count(ev->window));
+    WM_LOG(DEBUG, "ConfigureRequest from window {} (mask {x})", ev->window, ev->value_mask);
+    auto found = clients_.find(ev->window);
+    if (found == clients_.end()) {
+        // Not managed (yet), so grant the request as it is.
+        uint32_t values[7];
+        int i = 0;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_X)
+            values[i++] = static_cast<uint32_t>(ev->x);
+        if (ev->value_mask & XCB_CONFIG_WINDOW_Y)
+            values[i++] = static_cast<uint32_t>(ev->y);
+        if (ev->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+            values[i++] = ev->width;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+            values[i++] = ev->height;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+            values[i++] = ev->border_width;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING)
+            values[i++] = ev->sibling;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
+            values[i++] = ev->stack_mode;
+        errorHandler(xcb_configure_window(conn, ev->window, ev->value_mask, values),
+                     "configure window");
+        return;
+    }
     // If client want to configure, sure it will be fine.
-    // But we need to configure its frame first.
-    uint16_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT | XCB_CONFIG_WINDOW_BORDER_WIDTH | XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE;
-    const uint32_t values[] = {
-        static_cast<uint32_t>(ev->x),
-        static_cast<uint32_t>(ev->y),
-        ev->width,
-        ev->height,
-        ev->border_width,
-        ev->sibling,
-        ev->stack_mode,
+    // But we need to configure its frame first: position and stacking belong
+    // to the frame, the size to both.
+    Client &client = found->second;
+    // In a tiling layout the geometry is the layout's, only the stacking is
+    // up to the client.
+    uint16_t mask = ev->value_mask;
+    if (layout_ != Layout::FLOATING)
+        mask &= ~(XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH
+                  | XCB_CONFIG_WINDOW_HEIGHT);
+    if (mask & XCB_CONFIG_WINDOW_X)
+        client.frame_pos.x = ev->x;
+    if (mask & XCB_CONFIG_WINDOW_Y)
+        client.frame_pos.y = ev->y;
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)
+        client.size.width = ev->width;
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+        client.size.height = ev->height;
+    client.frame_size = Size<uint16_t>(client.pos.x + client.size.width,
+                                       client.pos.y + client.size.height);
+
+    uint16_t frame_mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+    uint32_t frame_values[6] = {
+        static_cast<uint32_t>(client.frame_pos.x),
+        static_cast<uint32_t>(client.frame_pos.y),
+        client.frame_size.width,
+        client.frame_size.height,
     };
-    if (clients_.count(ev->window)) {
-        errorHandler(
-            xcb_configure_window_checked(conn, clients_[ev->window], mask, values),
-            "configure frame"); /*ev->value_mask*/
-        LOG(INFO) << "Resize Frame [" << clients_[ev->window] << "] to "
-                  << Size<uint16_t>(ev->width, ev->height);
+    int i = 4;
+    if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING) {
+        // Siblings of the frame are frames as well.
+        Client *sibling = findClient(ev->sibling);
+        frame_mask |= XCB_CONFIG_WINDOW_SIBLING;
+        frame_values[i++] = sibling ? sibling->frame : ev->sibling;
+    }
+    if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE) {
+        frame_mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+        frame_values[i++] = ev->stack_mode;
+    }
+    errorHandler(xcb_configure_window(conn, client.frame, frame_mask, frame_values),
+                 "configure frame");
+
+    const uint32_t values[] = {client.size.width, client.size.height};
+    errorHandler(xcb_configure_window(conn, ev->window,
+                                      XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values),
+                 "configure window");
+    // Granted or not, the client is told where it ended up (ICCCM 4.1.5).
+    queueConfigureNotify(client);
+    WM_LOG(DEBUG, "Configured window {} [{}] to {}x{}", ev->window, client.frame,
+           client.size.width, client.size.height);
+}
+
+void WindowManager::queueConfigureNotify(Client &client)
+{
+    if (client.configure_notify)
+        return;
+    client.configure_notify = true;
+    configure_notifies_.push_back(client.window);
+}
+
+void WindowManager::sendConfigureNotifies()
+{
+    for (const xcb_window_t w : configure_notifies_) {
+        auto found = clients_.find(w);
+        if (found == clients_.end())
+            continue;
+        Client &client = found->second;
+        client.configure_notify = false;
+        // Root coordinates of the client, from the record alone.
+        xcb_configure_notify_event_t notify;
+        memset(&notify, 0, sizeof(notify));
+        notify.response_type = XCB_CONFIGURE_NOTIFY;
+        notify.event = client.window;
+        notify.window = client.window;
+        notify.above_sibling = XCB_NONE;
+        notify.x = static_cast<int16_t>(client.frame_pos.x + client.frame_border + client.pos.x);
+        notify.y = static_cast<int16_t>(client.frame_pos.y + client.frame_border + client.pos.y);
+        notify.width = client.size.width;
+        notify.height = client.size.height;
+        notify.border_width = client.border_width;
+        notify.override_redirect = false;
+        errorHandler(xcb_send_event(conn, false, client.window, XCB_EVENT_MASK_STRUCTURE_NOTIFY,
+                                    (const char *)&notify),
+                     "send synthetic ConfigureNotify");
     }
-    errorHandler(xcb_configure_window_checked(conn, ev->window, mask, values),
-                 "configure window"); /*ev->value_mask*/
-    LOG(INFO) << "Resize Window [" << clients_[ev->window] << "] to "
-              << Size<uint16_t>(ev->width, ev->height);
+    configure_notifies_.clear();
 }
 
 void WindowManager::onMapRequest(xcb_map_request_event_t *ev)
 {
-    printf("Captured Map request from window %u!\n", ev->window);
+    WM_LOG(DEBUG, "MapRequest from window {}", ev->window);
     // If client want to map, sure it will be fine.
     // And we must frame and reparent it first.
-    addFrame(ev->window, false);
-    errorHandler(xcb_map_window_checked(conn, ev->window), "map window");
+    if (clients_.count(ev->window)) {
+        errorHandler(xcb_map_window(conn, ev->window), "map window");
+        return;
+    }
+    xcb_get_geometry_cookie_t cookie_geo = xcb_get_geometry(conn, ev->window);
+    const PropertyCookies cookies = requestProperties(ev->window);
+    metrics_.roundTrip();
+    xcb_generic_error_t *error = nullptr;
+    xcb_get_geometry_reply_t *result_geo =
+        xcb_get_geometry_reply(conn, cookie_geo, &error);
+    if (result_geo == nullptr) {
+        // The client has gone before we could frame it.
+        WM_LOG(WARNING, "Ignore MapRequest for vanished window {}", ev->window);
+        free(error);
+        discardProperties(cookies);
+        return;
+    }
+    addFrame(ev->window, result_geo, cookies);
+    free(result_geo);
+    errorHandler(xcb_map_window(conn, ev->window), "map window");
 }
 
 void WindowManager::onResizeRequest(xcb_resize_request_event_t *ev)
 {
     // TODO - 这个resize是configure的子集吗？
-    printf("Captured Resize request from window %u!\n", ev->window);
+    WM_LOG(DEBUG, "ResizeRequest from window {}", ev->window);
 }
 
 void WindowManager::onFocusIn(xcb_focus_in_event_t *ev)
 {
-    printf("Captured FocusIn from window %u!\n", ev->event);
+    WM_LOG(DEBUG, "FocusIn window {} (mode {}, detail {})", ev->event, ev->mode, ev->detail);
+    // Focus moving in and out of grabs or within the client changes nothing.
+    if (ev->mode == XCB_NOTIFY_MODE_GRAB || ev->mode == XCB_NOTIFY_MODE_UNGRAB
+        || ev->detail == XCB_NOTIFY_DETAIL_INFERIOR || ev->detail == XCB_NOTIFY_DETAIL_POINTER)
+        return;
+    auto found = clients_.find(ev->event);
+    if (found == clients_.end() || found->second.focused)
+        return;
+    found->second.focused = true;
+    focused_ = found->first;
+    std::list<xcb_window_t> &order = focus_order_[found->second.desktop];
+    order.splice(order.begin(), order, found->second.focus_entry);
+    renderDecoration(found->second);
 }
 
 void WindowManager::onFocusOut(xcb_focus_out_event_t *ev)
 {
-    printf("Captured FocusOut from window %u!\n", ev->event);
+    WM_LOG(DEBUG, "FocusOut window {} (mode {}, detail {})", ev->event, ev->mode, ev->detail);
+    if (ev->mode == XCB_NOTIFY_MODE_GRAB || ev->mode == XCB_NOTIFY_MODE_UNGRAB
+        || ev->detail == XCB_NOTIFY_DETAIL_INFERIOR || ev->detail == XCB_NOTIFY_DETAIL_POINTER)
+        return;
+    auto found = clients_.find(ev->event);
+    if (found == clients_.end() || !found->second.focused)
+        return;
+    found->second.focused = false;
+    if (focused_ == found->first)
+        focused_ = XCB_NONE;
+    renderDecoration(found->second);
 }
 
 void WindowManager::onButtonPress(xcb_button_press_event_t *ev)
 {
-    print_modifiers(ev->state);
-    switch (ev->detail) {
-    case 4:
-        printf("Wheel Button up in window %u, at coordinates (%d,%d)\n",
-               ev->event, ev->event_x, ev->event_y);
-        break;
-    case 5:
-        printf("Wheel Button down in window %u, at coordinates (%d,%d)\n",
-               ev->event, ev->event_x, ev->event_y);
-        break;
-    default:
-        printf("Button %d pressed in window %u, at coordinates (%d,%d)\n",
-               ev->detail, ev->event, ev->event_x, ev->event_y);
-    }
-
+    WM_LOG(DEBUG, "Button {} pressed in window {} at ({}, {}), state {x}", ev->detail,
+           ev->event, ev->event_x, ev->event_y, ev->state);
     // We need supervise the button(mice click) status for the provision of
-    // motion in case.
-    CHECK(clients_.count(ev->child));
-    // 1. Store current window position and geometry.
-    // NOTE - The coordinates must be global!
-    drag_start_pos_ = Position<int16_t>(ev->event_x, ev->event_y);
-    xcb_generic_error_t *error = nullptr;
-    xcb_get_geometry_cookie_t cookie_geo = xcb_get_geometry(conn, ev->event);
-    xcb_get_geometry_reply_t *result_geo =
-        xcb_get_geometry_reply(conn, cookie_geo, &error);
-    errorHandler(error, "get window geometry");
-
-    // Query for its parent window.
-    xcb_query_tree_reply_t *result_tree =
-        xcb_query_tree_reply(conn, xcb_query_tree(conn, ev->event), &error);
-    xcb_translate_coordinates_reply_t *result_trans =
-        xcb_translate_coordinates_reply(
-            conn,
-            xcb_translate_coordinates(conn, ev->child, result_tree->parent,
-                                      result_geo->x, result_geo->y),
-            &error);
-    errorHandler(error, "query for parent tree");
-    drag_start_frame_pos_ =
-        Position<int16_t>(result_trans->dst_x, result_trans->dst_y);
-    drag_start_frame_size_ = Size<int16_t>(result_geo->width, result_geo->height);
-    free(result_geo);
-    free(result_tree);
-    free(result_trans);
+    // motion in case. The buttons are grabbed on the root, the child is the
+    // frame under the pointer.
+    Client *target = findClient(ev->child);
+    if (target == nullptr)
+        return;
+    Client &client = *target;
+    // Alt + middle button closes the window, nothing is dragged.
+    if (ev->detail == XCB_BUTTON_INDEX_2) {
+        closeClient(client, ev->time);
+        return;
+    }
+    // Tiled windows are only raised, the layout places them.
+    if (layout_ == Layout::FLOATING) {
+        // 1. Store current window position and geometry.
+        // NOTE - The coordinates must be global!
+        drag_window_ = client.window;
+        drag_start_pos_ = Position<int16_t>(ev->root_x, ev->root_y);
+        drag_start_frame_pos_ = client.frame_pos;
+        drag_start_frame_size_ = Size<int16_t>(client.frame_size.width, client.frame_size.height);
+        resize_waiting_ = sync_waiting_ = false;
+    }
     // 2. Raise clicked window to top.
-    errorHandler(xcb_configure_window_checked(
-                     conn, ev->child, XCB_CONFIG_WINDOW_STACK_MODE,
-                     (const uint32_t[]){XCB_STACK_MODE_ABOVE}),
-                 "raise to top");
+    raise(client);
 }
 
 void WindowManager::onButtonRelease(xcb_button_release_event_t *ev)
 {
-    print_modifiers(ev->state);
-    printf("Button %d released in window %u, at coordinates (%d,%d)\n",
-           ev->detail, ev->event, ev->event_x, ev->event_y);
+    WM_LOG(DEBUG, "Button {} released in window {} at ({}, {}), state {x}", ev->detail,
+           ev->event, ev->event_x, ev->event_y, ev->state);
+    if (drag_window_ == XCB_NONE)
+        return;
+    // Whatever motion the frame pacing still holds back, the drag ends exactly
+    // where the button was released.
+    motions_.erase(ev->event);
+    auto found = clients_.find(drag_window_);
+    if (found != clients_.end())
+        dragTo(found->second, Position<int16_t>(ev->root_x, ev->root_y), ev->state, true);
+    // Whatever the buttons were, no outline outlives the drag.
+    drawOutline(Rect());
+    drag_window_ = XCB_NONE;
 }
 
 void WindowManager::onKeyRelease(xcb_key_release_event_t *ev)
 {
-    print_modifiers(ev->state);
-    printf("Key released in window %u\n", ev->event);
+    WM_LOG(DEBUG, "Key {} released in window {}, state {x}", ev->detail, ev->event,
+           ev->state);
+    // Releasing a modifier of the Alt+Tab binding commits the cycle.
+    if (cycle_modifiers_ == 0 || !(keyboard_->modifiersOf(ev->detail) & cycle_modifiers_))
+        return;
+    cycle_modifiers_ = 0;
+    errorHandler(xcb_ungrab_keyboard(conn, ev->time), "ungrab keyboard");
+    // Put back what the previews raised, only the chosen window goes on top.
+    restack(cycle_stacking_);
+    cycle_stacking_.clear();
+    auto found = clients_.find(cycle_target_);
+    cycle_target_ = XCB_NONE;
+    if (found != clients_.end())
+        focusClient(found->second, ev->time);
+}
+
+void WindowManager::cycleFocus(bool forward, xcb_timestamp_t time, uint16_t modifiers)
+{
+    std::list<xcb_window_t> &order = focusOrder();
+    if (order.empty())
+        return;
+    if (cycle_modifiers_ == 0) {
+        // Start from the focused window. The keyboard is grabbed so that the
+        // release of the modifier comes to us wherever the focus is. Whether
+        // the grab succeeded doesn't change anything, the reply is discarded.
+        cycle_target_ = focused_;
+        if (modifiers != 0) {
+            cycle_modifiers_ = modifiers;
+            cycle_stacking_.assign(stacking_.begin(), stacking_.end());
+            metrics_.request();
+            xcb_discard_reply(conn, xcb_grab_keyboard(conn, 0, root, time,
+                                                      XCB_GRAB_MODE_ASYNC,
+                                                      XCB_GRAB_MODE_ASYNC).sequence);
+        }
+    }
+    // Step through the MRU order, which doesn't change until the cycle ends.
+    auto found = clients_.find(cycle_target_);
+    std::list<xcb_window_t>::iterator next;
+    if (found == clients_.end() || found->second.desktop != current_desktop_) {
+        next = forward ? order.begin() : std::prev(order.end());
+    } else if (forward) {
+        next = std::next(found->second.focus_entry);
+        if (next == order.end())
+            next = order.begin();
+    } else {
+        next = found->second.focus_entry;
+        next = next == order.begin() ? std::prev(order.end()) : std::prev(next);
+    }
+    cycle_target_ = *next;
+    Client &target = clients_.at(cycle_target_);
+    if (cycle_modifiers_ == 0) {
+        // Nothing to hold, the switch is immediate.
+        focusClient(target, time);
+        return;
+    }
+    // Preview: raise the window, the focus follows when the cycle ends.
+    raise(target);
+}
+
+void WindowManager::focusClient(Client &client, xcb_timestamp_t time)
+{
+    WM_LOG(INFO, "Focus window {}", client.window);
+    raise(client);
+    if (client.take_focus) {
+        xcb_client_message_event_t msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.response_type = XCB_CLIENT_MESSAGE;
+        msg.window = client.window;
+        msg.type = atoms_[Atom::WM_PROTOCOLS];
+        msg.format = 32;
+        msg.data.data32[0] = atoms_[Atom::WM_TAKE_FOCUS];
+        msg.data.data32[1] = time;
+        errorHandler(xcb_send_event(conn, false, client.window, XCB_EVENT_MASK_NO_EVENT,
+                                    (const char *)&msg),
+                     "send take focus message");
+    }
+    // The MRU order is updated by the FocusIn this causes. A client without
+    // the input hint takes the focus itself, if at all (ICCCM 4.1.7).
+    if (client.input)
+        errorHandler(xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT, client.window, time),
+                     "focus window");
+}
+
+void WindowManager::focusLastUsed(xcb_timestamp_t time)
+{
+    if (!focusOrder().empty())
+        focusClient(clients_.at(focusOrder().front()), time);
+    else
+        errorHandler(xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT,
+                                         XCB_INPUT_FOCUS_POINTER_ROOT, time),
+                     "focus root");
+}
+
+void WindowManager::switchDesktop(uint32_t desktop, xcb_timestamp_t time)
+{
+    if (desktop >= focus_order_.size() || desktop == current_desktop_)
+        return;
+    // An Alt+Tab cycle can't go on across desktops.
+    if (cycle_modifiers_ != 0) {
+        cycle_modifiers_ = 0;
+        cycle_target_ = XCB_NONE;
+        cycle_stacking_.clear();
+        errorHandler(xcb_ungrab_keyboard(conn, time), "ungrab keyboard");
+    }
+    // Map the new desktop first, so that the root doesn't show in between.
+    for (const xcb_window_t w : focus_order_[desktop])
+        show(clients_.at(w));
+    for (const xcb_window_t w : focusOrder())
+        hide(clients_.at(w));
+    WM_LOG(INFO, "Switched from desktop {} ({} windows) to {} ({} windows)", current_desktop_,
+           focusOrder().size(), desktop, focus_order_[desktop].size());
+    current_desktop_ = desktop;
+    relayout_ = true;
+    focusLastUsed(time);
+}
+
+void WindowManager::moveToDesktop(Client &client, uint32_t desktop)
+{
+    if (desktop >= focus_order_.size() || desktop == client.desktop)
+        return;
+    std::list<xcb_window_t> &from = focus_order_[client.desktop];
+    std::list<xcb_window_t> &to = focus_order_[desktop];
+    to.splice(to.begin(), from, client.focus_entry);
+    if (client.desktop == current_desktop_)
+        hide(client);
+    else if (desktop == current_desktop_)
+        show(client);
+    client.desktop = desktop;
+    errorHandler(xcb_change_property(conn, XCB_PROP_MODE_REPLACE, client.window,
+                                     atoms_[Atom::NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 32, 1,
+                                     &client.desktop),
+                 "set _NET_WM_DESKTOP");
+    relayout_ = true;
+    if (focused_ == client.window)
+        focusLastUsed(XCB_CURRENT_TIME);
+}
+
+void WindowManager::show(Client &client)
+{
+    errorHandler(xcb_map_window(conn, client.window), "map window");
+    errorHandler(xcb_map_window(conn, client.frame), "map frame");
+}
+
+void WindowManager::hide(Client &client)
+{
+    // The frame goes first, so the window disappears as a whole.
+    errorHandler(xcb_unmap_window(conn, client.frame), "unmap frame");
+    errorHandler(xcb_unmap_window(conn, client.window), "unmap window");
+    ++client.ignore_unmaps;
 }
 
 void WindowManager::onMotionNotify(xcb_motion_notify_event_t *ev)
 {
-    printf("Mouse moved in window %u, at coordinates (%d,%d)\n", ev->event,
-           ev->event_x, ev->event_y);
-
-    // Now we can check the window position to see if it has moved.
-    LOG(WARNING) << clients_.size();
-    for (auto &ele : clients_)
-        LOG(WARNING) << ele.first << " : " << ele.second << std::endl;
-    LOG(INFO) << ev->root << " | " << ev->event << " | " << ev->child;
-    CHECK(clients_.count(
-        ev->child)); // FIXME - 问题，鼠标经过窗口，应该是先经过外部的frame吧。因此这里ev->event是外框，ev->child是孩子
-    // 1. Move the frame first.
-    xcb_generic_error_t *error;
-    xcb_query_tree_reply_t *result_tree =
-        xcb_query_tree_reply(conn, xcb_query_tree(conn, ev->child), &error);
-    // 2. Move the window to destination.
-    const Position<int16_t> drag_pos(ev->root_x, ev->root_y);
+    WM_LOG(DEBUG, "Pointer moved in window {} to ({}, {})", ev->event, ev->root_x,
+           ev->root_y);
+    // The buttons are grabbed on the root, the dragged client is the one the
+    // button was pressed on.
+    if (drag_window_ == XCB_NONE)
+        return;
+    auto found = clients_.find(drag_window_);
+    if (found == clients_.end())
+        return;
+    dragTo(found->second, Position<int16_t>(ev->root_x, ev->root_y), ev->state, false);
+}
+
+void WindowManager::dragTo(Client &client, const Position<int16_t> &drag_pos,
+                           uint16_t state, bool done)
+{
+    // 1. Compute how far the pointer has been dragged.
     const Vector2D<int16_t> delta = drag_pos - drag_start_pos_;
-    // 3. Check the pressed keys.
-    // Move the frame, so its children should be moved(the children won't move automatically,
-    // I just didn't write relavent code here).
-    if (ev->state & XCB_BUTTON_MASK_1) {
-        LOG(INFO) << "Alt+Mouse Left Click pressed";
+    // 2. Check the pressed keys.
+    // Move the frame, the client is moved along with it.
+    if (state & XCB_BUTTON_MASK_1) {
         const Position<int16_t> dest_frame_pos = drag_start_frame_pos_ + delta;
-        const static uint32_t values[] = {static_cast<uint32_t>(dest_frame_pos.x),
-                                          static_cast<uint32_t>(dest_frame_pos.y)};
-        errorHandler(xcb_configure_window_checked(conn, clients_[ev->child],
-                                                  ev->state, values),
+        const uint32_t values[] = {static_cast<uint32_t>(dest_frame_pos.x),
+                                   static_cast<uint32_t>(dest_frame_pos.y)};
+        errorHandler(xcb_configure_window(conn, client.frame,
+                                          XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values),
                      "move window");
-    } else if (ev->state & XCB_BUTTON_MASK_3) {
-        LOG(INFO) << "Alt+Mouse Right Click pressed";
-        auto cmp = [](int16_t a, int16_t b) -> int16_t {
-            return a > b ? a : b;
-        };
-        const Vector2D<int16_t> size_delta(
-            // std::max(delta.x, -drag_start_frame_size_.width),
-            // std::max(delta.y, -drag_start_frame_size_.height)
-            cmp(delta.x, -drag_start_frame_size_.width),
-            cmp(delta.y, -drag_start_frame_size_.height));
-        const Size<int16_t> dest_frame_size = drag_start_frame_size_ + size_delta;
-        // Resize frame.
-        const uint32_t values[] = {static_cast<uint32_t>(dest_frame_size.width),
-                                   static_cast<uint32_t>(dest_frame_size.height)};
-        errorHandler(
-            xcb_configure_window_checked(
-                conn, clients_[ev->child],
-                XCB_CONFIG_WINDOW_BORDER_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values),
-            "resize window");
-        // Resize client.
+        client.frame_pos = dest_frame_pos;
+        // Also when the drag ends where the last tick left it: the client
+        // hears the final position at least once.
+        queueConfigureNotify(client);
+    } else if (state & XCB_BUTTON_MASK_3) {
+        // The size the client would get, then the closest one it accepts, so
+        // that the frame always fits the client.
+        const Size<uint16_t> size = constrain_size(
+            client.normal_hints, drag_start_frame_size_.width + delta.x - client.pos.x,
+            drag_start_frame_size_.height + delta.y - client.pos.y);
+        resizeTo(client, size, done);
+    }
+}
+
+void WindowManager::resizeTo(Client &client, const Size<uint16_t> &size, bool done)
+{
+    const Size<uint16_t> frame_size(size.width + client.pos.x, size.height + client.pos.y);
+    const ResizeMode mode = done ? ResizeMode::LIVE : config_.resize_mode;
+    if (mode == ResizeMode::OUTLINE) {
+        drawOutline(Rect(client.frame_pos.x, client.frame_pos.y,
+                         frame_size.width + 2 * client.frame_border,
+                         frame_size.height + 2 * client.frame_border));
+        return;
+    }
+    drawOutline(Rect());
+    // Resize frame.
+    if (frame_size.width != client.frame_size.width
+        || frame_size.height != client.frame_size.height) {
+        const uint32_t values[] = {frame_size.width, frame_size.height};
         errorHandler(
-            xcb_configure_window_checked(
-                conn, ev->child,
-                XCB_CONFIG_WINDOW_BORDER_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values),
-            "resize window");
+            xcb_configure_window(
+                conn, client.frame,
+                XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values),
+            "resize frame");
+        client.frame_size = frame_size;
+    }
+    // Resize client, in frame mode only once the drag is done. Sizes the
+    // client has no time to paint are skipped, the last one is always sent.
+    if (mode == ResizeMode::LIVE) {
+        resize_target_ = size;
+        resize_waiting_ = size.width != client.size.width || size.height != client.size.height;
+        applyResize(done);
+    }
+}
+
+int WindowManager::applyResize(bool force)
+{
+    if (!resize_waiting_)
+        return -1;
+    auto found = clients_.find(drag_window_);
+    if (found == clients_.end()) {
+        resize_waiting_ = false;
+        return -1;
     }
+    Client &client = found->second;
+    const bool sync = sync_event_ != 0 && client.sync_request && client.sync_counter != XCB_NONE;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force) {
+        // A synced client is sent the next size once it has painted the last
+        // one, or gave no sign of life for too long. The others get a fixed rate.
+        std::chrono::steady_clock::time_point due = now;
+        if (sync && sync_waiting_)
+            due = resize_sent_ + SYNC_TIMEOUT;
+        else if (!sync && config_.resize_rate != 0)
+            due = resize_sent_ + std::chrono::microseconds(1000000 / config_.resize_rate);
+        if (now < due) {
+            // Round up, so that we don't wake up just before it is due.
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       due - now + std::chrono::microseconds(999))
+                .count();
+        }
+        if (sync && sync_waiting_)
+            WM_LOG(WARNING, "Window {} didn't answer _NET_WM_SYNC_REQUEST {}", client.window,
+                   client.sync_value);
+    }
+    if (sync)
+        sendSyncRequest(client);
+    const uint32_t values[] = {resize_target_.width, resize_target_.height};
+    errorHandler(
+        xcb_configure_window(
+            conn, client.window,
+            XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values),
+        "resize window");
+    client.size = resize_target_;
+    resize_sent_ = now;
+    resize_waiting_ = false;
+    return -1;
+}
+
+void WindowManager::sendSyncRequest(Client &client)
+{
+    ++client.sync_value;
+    const uint32_t value[] = {static_cast<uint32_t>(client.sync_value >> 32),
+                              static_cast<uint32_t>(client.sync_value)};
+    if (client.sync_alarm == XCB_NONE) {
+        client.sync_alarm = xcb_generate_id(conn);
+        // Triggered when counter >= value.
+        const uint32_t values[] = {client.sync_counter,
+                                   XCB_SYNC_VALUETYPE_ABSOLUTE,
+                                   value[0], value[1],
+                                   XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+                                   0, 1, // delta
+                                   1}; // events
+        errorHandler(xcb_sync_create_alarm(conn, client.sync_alarm,
+                                           XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE
+                                               | XCB_SYNC_CA_VALUE | XCB_SYNC_CA_TEST_TYPE
+                                               | XCB_SYNC_CA_DELTA | XCB_SYNC_CA_EVENTS,
+                                           values),
+                     "create sync alarm");
+    } else {
+        errorHandler(xcb_sync_change_alarm(conn, client.sync_alarm, XCB_SYNC_CA_VALUE, value),
+                     "set sync alarm");
+    }
+    // The request goes before the configure it is about.
+    xcb_client_message_event_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.response_type = XCB_CLIENT_MESSAGE;
+    msg.window = client.window;
+    msg.type = atoms_[Atom::WM_PROTOCOLS];
+    msg.format = 32;
+    msg.data.data32[0] = atoms_[Atom::NET_WM_SYNC_REQUEST];
+    msg.data.data32[1] = XCB_CURRENT_TIME;
+    msg.data.data32[2] = value[1];
+    msg.data.data32[3] = value[0];
+    errorHandler(xcb_send_event(conn, false, client.window, XCB_EVENT_MASK_NO_EVENT,
+                                (const char *)&msg),
+                 "send sync request");
+    sync_waiting_ = true;
+}
+
+void WindowManager::onSyncAlarm(xcb_sync_alarm_notify_event_t *ev)
+{
+    WM_LOG(DEBUG, "Sync alarm {} at {}", ev->alarm, ev->counter_value.lo);
+    // Only the client being resized is waited for, the next size is sent
+    // after the batch.
+    auto found = clients_.find(drag_window_);
+    if (found != clients_.end() && found->second.sync_alarm == ev->alarm)
+        sync_waiting_ = false;
+}
+
+void WindowManager::drawOutline(const Rect &outline)
+{
+    if (outline == outline_)
+        return;
+    const bool shown = outline_.width != 0;
+    xcb_rectangle_t rects[2];
+    uint32_t count = 0;
+    // XOR: drawing the old outline again erases it.
+    if (shown)
+        rects[count++] = {outline_.x, outline_.y, static_cast<uint16_t>(outline_.width - 1),
+                          static_cast<uint16_t>(outline_.height - 1)};
+    if (outline.width != 0)
+        rects[count++] = {outline.x, outline.y, static_cast<uint16_t>(outline.width - 1),
+                          static_cast<uint16_t>(outline.height - 1)};
+    // Grabbed only between erasing and drawing, so that no client paints in
+    // between, and released in the same call: the server never stays frozen
+    // for the drag, whichever way the drag ends.
+    errorHandler(xcb_grab_server(conn), "grab X Server for the outline");
+    errorHandler(xcb_poly_rectangle(conn, root, outline_gc_, count, rects), "draw outline");
+    errorHandler(xcb_ungrab_server(conn), "ungrab X Server");
+    outline_ = outline;
 }
 
 void WindowManager::onEnterNotify(xcb_enter_notify_event_t *ev)
 {
-    printf("Mouse entered window %u, at coordinates (%d,%d)\n", ev->event,
-           ev->event_x, ev->event_y);
-    cursor_set(conn, screen, ev->event, 58);
+    WM_LOG(DEBUG, "Pointer entered window {} at ({}, {})", ev->event, ev->event_x,
+           ev->event_y);
 }
 
 void WindowManager::onLeaveNotify(xcb_leave_notify_event_t *ev)
 {
-    printf("Mouse left window %u, at coordinates (%d,%d)\n", ev->event,
-           ev->event_x, ev->event_y);
-    cursor_set(conn, screen, ev->event, 68);
+    WM_LOG(DEBUG, "Pointer left window {} at ({}, {})", ev->event, ev->event_x,
+           ev->event_y);
+}
+
+void WindowManager::closeClient(const Client &client, xcb_timestamp_t time)
+{
+    if (client.delete_window) {
+        WM_LOG(INFO, "Send WM_DELETE_WINDOW to window {}", client.window);
+
+        xcb_client_message_event_t msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.response_type = XCB_CLIENT_MESSAGE;
+        msg.window = client.window;
+        msg.type = atoms_[Atom::WM_PROTOCOLS];
+        msg.format = 32;
+        msg.data.data32[0] = atoms_[Atom::WM_DELETE_WINDOW];
+        msg.data.data32[1] = time;
+
+        errorHandler(
+            xcb_send_event(conn, false, client.window,
+                           XCB_EVENT_MASK_NO_EVENT, (const char *)&msg),
+            "send window delete message");
+    } else {
+        // Just kill window by force.
+        WM_LOG(INFO, "Killing window {}", client.window);
+        errorHandler(xcb_kill_client(conn, client.window), "kill window");
+    }
 }
 
 void WindowManager::onKeyPress(xcb_key_press_event_t *ev)
 {
-    printf("Key pressed in window %u, ", ev->event);
-    print_modifiers(ev->state);
-
-    // ESC: Close window.
-    xcb_key_symbols_t *symbols = xcb_key_symbols_alloc(conn);
-    xcb_keysym_t keysym = xcb_key_symbols_get_keysym(symbols, ev->detail, 0);
-    // After elimate the target window, the next window in the stacking order
-    // should get focus.
-    if (ev->detail == static_cast<xcb_keycode_t>(KeyMap::ESC)) {
-        xcb_icccm_get_wm_protocols_reply_t protocols_reply;
-        if (xcb_icccm_get_wm_protocols_reply(
-                conn, xcb_icccm_get_wm_protocols(conn, ev->child, WM_DELETE_WINDOW),
-                &protocols_reply, NULL)) {
-            if (std::find(protocols_reply.atoms,
-                          protocols_reply.atoms + protocols_reply.atoms_len,
-                          WM_DELETE_WINDOW)
-                != protocols_reply.atoms + protocols_reply.atoms_len) {
-                LOG(INFO) << "Send message to deleting window " << ev->child;
-
-                xcb_client_message_event_t msg;
-                memset(&msg, 0, sizeof(msg));
-                msg.response_type = XCB_CLIENT_MESSAGE;
-                msg.window = ev->child;
-                msg.type = XCB_ATOM_STRING;
-                msg.format = 32;
-                msg.data.data32[0] = WM_DELETE_WINDOW;
-
-                errorHandler(
-                    xcb_send_event_checked(conn, false, ev->child,
-                                           XCB_EVENT_MASK_NO_EVENT, (const char *)&msg),
-                    "send window delete message");
-
-                xcb_flush(conn);
-
-                xcb_icccm_get_wm_protocols_reply_wipe(&protocols_reply);
-            } else {
-                // Just kill window by force.
-                LOG(INFO) << "Killing window " << ev->child;
-                xcb_kill_client(conn, ev->child);
-                xcb_flush(conn);
-            }
-        }
-    } else if (ev->detail == XCB_MOD_MASK_CONTROL) {
-        // Ctrl: Switch window.
-        // (Assuming clients_ is a std::map or similar container)
-        auto i = clients_.find(ev->child);
-        if (i != clients_.end()) {
-            ++i;
-            if (i == clients_.end())
-                i = clients_.begin();
-
-            // Raise and set focus
-            xcb_change_window_attributes(conn, i->second, XCB_STACK_MODE_ABOVE,
-                                         (const uint32_t[]){XCB_STACK_MODE_ABOVE});
-            xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT, i->first,
-                                XCB_CURRENT_TIME);
-
-            xcb_flush(conn);
-        }
+    WM_LOG(DEBUG, "Key {} pressed in window {}, state {x}", ev->detail, ev->event,
+           ev->state);
+
+    // The keys are grabbed on the root, they act on the focused client.
+    const Command command = keyboard_->lookup(ev->detail, ev->state);
+    switch (command.action) {
+    case Action::CLOSE_WINDOW: {
+        auto found = clients_.find(focused_);
+        if (found != clients_.end())
+            closeClient(found->second, ev->time);
+        break;
+    }
+    case Action::NEXT_WINDOW:
+    case Action::PREVIOUS_WINDOW:
+        // Shift only picks the direction, releasing it doesn't end the cycle.
+        cycleFocus(command.action == Action::NEXT_WINDOW, ev->time,
+                   ev->state & 0xff & ~(keyboard_->locks() | XCB_MOD_MASK_SHIFT));
+        break;
+    case Action::NEXT_LAYOUT:
+        layout_ = next_layout(layout_);
+        relayout_ = true;
+        WM_LOG(INFO, "Switched to the {} layout", layout_name(layout_));
+        break;
+    case Action::SWITCH_DESKTOP:
+        switchDesktop(command.argument, ev->time);
+        break;
+    case Action::MOVE_TO_DESKTOP: {
+        auto found = clients_.find(focused_);
+        if (found != clients_.end())
+            moveToDesktop(found->second, command.argument);
+        break;
+    }
+    case Action::NONE:
+        break;
     }
 }
 
+void WindowManager::onMappingNotify(xcb_mapping_notify_event_t *ev)
+{
+    if (!keyboard_->refresh(ev))
+        return;
+    // The keycodes of the bindings may have changed, grab them again.
+    errorHandler(xcb_ungrab_key(conn, XCB_GRAB_ANY, root, XCB_MOD_MASK_ANY), "ungrab keys");
+    grabKeys();
+}
+
+void WindowManager::onError(xcb_generic_error_t *error)
+{
+    // The request may well have failed because its client went away in the
+    // meantime, so a deferred error is reported but never fatal.
+    const RequestTracker::Request *request = requests_.find(error->full_sequence);
+    if (request == nullptr) {
+        WM_LOG(ERROR, "untracked request {} failed. : {} (opcode {})",
+               error->full_sequence, error->error_code, error->major_code);
+        return;
+    }
+    WM_LOG(ERROR, "{} failed in {}. : {} (resource {})", request->message,
+           request->origin, error->error_code, error->resource_id);
+}
+
 void WindowManager::errorHandler(xcb_generic_error_t *error,
                                  const char *message) const noexcept
 {
@@ -684,17 +1929,10 @@ void WindowManager::errorHandler(xcb_generic_error_t *error,
 }
 
 void WindowManager::errorHandler(xcb_void_cookie_t cookie,
-                                 const char *message) const noexcept
+                                 const char *message) noexcept
 {
-    if (auto error = xcb_request_check(conn, cookie)) {
-        // fprintf(stderr, "ERROR: can't %s : %d\n", message,
-        // error->error_code);
-        LOG(ERROR) << message << " failed. : " << error->error_code;
-        free(error);
-        error = nullptr;
-        xcb_disconnect(conn);
-        exit(EXIT_FAILURE);
-    }
+    requests_.track(cookie, message, dispatching_);
+    metrics_.request();
 }
 
 } // namespace x11